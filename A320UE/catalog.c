@@ -0,0 +1,408 @@
+/**
+ * A320UE - X-Plane 11 Plugin
+ *
+ * A plugin for the FlightFactor A320 Ultimate that adds a couple of new
+ * commands for operating the thrust levers more comfortably as well as a
+ * bunch of other little workarounds and/or features.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+#include <stdlib.h>
+
+#define CAT_MAGIC       0x31434646 /* FFC1 */
+#define CAT_VERSION     2
+#define CAT_FILE        "ff_catalog.cache"
+#define CAT_MAX_DEPTH   32
+
+/**
+ * Catalog of all values the A320U exposes, built once by walking the FF API
+ * and afterwards persisted to disk keyed by the API's DataVersion, so later
+ * sessions with the same version of the aircraft don't have to walk it
+ * again. Objects can create values at runtime though, so the version alone
+ * doesn't guarantee that an id still names the same value; a cached catalog
+ * is checked against the live API before it is used, and ids are checked
+ * again whenever they are looked up.
+ *
+ * Entries are sorted by their full dotted path, which turns prefix queries
+ * into a binary search and keeps the children of an object right behind
+ * it, and indexed by an open-addressing hash table for lookups by name. All
+ * paths live in a single string pool.
+ */
+static struct {
+    const ff_api_t *api;
+    catalog_entry_t *entries;
+    int num;
+    char *pool;
+    unsigned int pool_len;
+    /* hash index, holds entry index + 1 */
+    int *slots;
+    unsigned int num_slots;
+} cat;
+
+/* Entry as it is stored on disk, with the name as pool offset. */
+typedef struct {
+    int id;
+    int parent;
+    unsigned int type;
+    unsigned int units;
+    unsigned int name;
+} cat_rec_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int rec_size;
+    unsigned int data_version;
+    /* ValuesCount at the time the catalog was built */
+    unsigned int values_count;
+    int num;
+    unsigned int pool_len;
+} cat_hdr_t;
+
+static unsigned int cat_hash(const char *s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int cat_cmp(const void *a, const void *b) {
+    return strcmp(((const catalog_entry_t*)a)->name,
+        ((const catalog_entry_t*)b)->name);
+}
+
+static int cat_index() {
+    unsigned int n = 64;
+    while (n < (unsigned int)cat.num * 2)
+        n *= 2;
+    if (!(cat.slots = calloc(n, sizeof(int))))
+        return 0;
+    cat.num_slots = n;
+    for (int i = 0; i < cat.num; i++) {
+        unsigned int k = cat_hash(cat.entries[i].name) & (n - 1);
+        while (cat.slots[k])
+            k = (k + 1) & (n - 1);
+        cat.slots[k] = i + 1;
+    }
+    return 1;
+}
+
+/**
+ * Sorts the entries by path and fixes up the parent references, which
+ * hold value ids until here, to point at entry indices instead.
+ */
+static int cat_sort() {
+    qsort(cat.entries, cat.num, sizeof(catalog_entry_t), cat_cmp);
+    int max_id = -1;
+    for (int i = 0; i < cat.num; i++)
+        max_id = max(max_id, cat.entries[i].id);
+    int *by_id = malloc((max_id + 1) * sizeof(int));
+    if (!by_id)
+        return 0;
+    memset(by_id, 0xFF, (max_id + 1) * sizeof(int));
+    for (int i = 0; i < cat.num; i++)
+        by_id[cat.entries[i].id] = i;
+    for (int i = 0; i < cat.num; i++) {
+        int p = cat.entries[i].parent;
+        cat.entries[i].parent = p >= 0 && p <= max_id ? by_id[p] : -1;
+    }
+    free(by_id);
+    return 1;
+}
+
+static int cat_pool_add(const char *s, int len, unsigned int *cap) {
+    if (cat.pool_len + len + 1 > *cap) {
+        unsigned int c = max(*cap * 2, cat.pool_len + len + 1);
+        char *pool = realloc(cat.pool, c);
+        if (!pool)
+            return -1;
+        cat.pool = pool;
+        *cap = c;
+    }
+    int off = cat.pool_len;
+    memcpy(cat.pool + off, s, len);
+    cat.pool[off + len] = '\0';
+    cat.pool_len += len + 1;
+    return off;
+}
+
+/**
+ * Builds the full path of the value with the specified id into buf.
+ * Depending on the value, ValueName may already return the full path or
+ * only the last component of it.
+ */
+static int cat_path(const ff_api_t *api, int id, char *buf, int size,
+    int depth) {
+    const char *name = api->ValueName(id);
+    int parent = api->ValueParent(id);
+    if (!name)
+        return 0;
+    if (parent < 0 || parent == id || depth >= CAT_MAX_DEPTH)
+        return snprintf(buf, size, "%s", name) < size;
+    if (!cat_path(api, parent, buf, size, depth + 1))
+        return 0;
+    int len = strlen(buf);
+    if (!strncmp(name, buf, len) && name[len] == '.')
+        return snprintf(buf, size, "%s", name) < size;
+    return snprintf(buf + len, size - len, ".%s", name) < size - len;
+}
+
+static int cat_walk(const ff_api_t *api) {
+    char path[PATH_BUF];
+    unsigned int count = api->ValuesCount(), cap = 0;
+    if (!count)
+        return 0;
+    if (!(cat.entries = malloc(count * sizeof(catalog_entry_t))))
+        return 0;
+    /* Names are pool offsets until the pool has stopped moving. */
+    unsigned int *offs = malloc(count * sizeof(unsigned int));
+    if (!offs)
+        return 0;
+    for (unsigned int i = 0; i < count; i++) {
+        int id = api->ValueIdByIndex(i);
+        if (id < 0 || api->ValueType(id) == Value_Type_Deleted)
+            continue;
+        if (!cat_path(api, id, path, sizeof(path), 0))
+            continue;
+        int off = cat_pool_add(path, strlen(path), &cap);
+        if (off < 0) {
+            free(offs);
+            return 0;
+        }
+        catalog_entry_t *e = &cat.entries[cat.num];
+        e->id = id;
+        e->parent = api->ValueParent(id);
+        e->type = api->ValueType(id);
+        e->units = api->ValueUnits(id);
+        offs[cat.num++] = off;
+    }
+    for (int i = 0; i < cat.num; i++)
+        cat.entries[i].name = cat.pool + offs[i];
+    free(offs);
+    return cat_sort();
+}
+
+/**
+ * Returns 1 if the live value with the entry's id still has the entry's
+ * type and name. ValueName may return the full path or only its last
+ * component.
+ */
+static int cat_live(const catalog_entry_t *e) {
+    const ff_api_t *api = cat.api;
+    if (api->ValueType(e->id) != e->type)
+        return 0;
+    const char *name = api->ValueName(e->id);
+    if (!name)
+        return 0;
+    int len = strlen(e->name), n = strlen(name);
+    if (n == len)
+        return !strcmp(name, e->name);
+    return n < len && e->name[len - n - 1] == '.' &&
+        !strcmp(name, e->name + len - n);
+}
+
+/**
+ * Checks a catalog loaded from disk against the live API, so that ids left
+ * over from a session in which values were created at runtime aren't used.
+ */
+static int cat_verify(unsigned int values_count) {
+    if (cat.api->ValuesCount() != values_count)
+        return 0;
+    for (int i = 0; i < cat.num; i++) {
+        if (!cat_live(&cat.entries[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static int cat_load(const char *path, unsigned int data_version,
+    unsigned int *values_count) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    cat_hdr_t hdr;
+    cat_rec_t *recs = NULL;
+    int ok = 0;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != CAT_MAGIC ||
+        hdr.version != CAT_VERSION || hdr.rec_size != sizeof(cat_rec_t) ||
+        hdr.data_version != data_version || hdr.num <= 0 || !hdr.pool_len) {
+        goto done;
+    }
+    recs = malloc(hdr.num * sizeof(cat_rec_t));
+    cat.entries = malloc(hdr.num * sizeof(catalog_entry_t));
+    cat.pool = malloc(hdr.pool_len);
+    if (!recs || !cat.entries || !cat.pool)
+        goto done;
+    if (fread(recs, sizeof(cat_rec_t), hdr.num, fp) != (size_t)hdr.num ||
+        fread(cat.pool, 1, hdr.pool_len, fp) != hdr.pool_len) {
+        goto done;
+    }
+    /* Don't trust offsets into the pool without checking. */
+    cat.pool[hdr.pool_len - 1] = '\0';
+    for (int i = 0; i < hdr.num; i++) {
+        if (recs[i].name >= hdr.pool_len || recs[i].parent < -1 ||
+            recs[i].parent >= hdr.num) {
+            goto done;
+        }
+        catalog_entry_t *e = &cat.entries[i];
+        e->id = recs[i].id;
+        e->parent = recs[i].parent;
+        e->type = recs[i].type;
+        e->units = recs[i].units;
+        e->name = cat.pool + recs[i].name;
+    }
+    cat.num = hdr.num;
+    cat.pool_len = hdr.pool_len;
+    *values_count = hdr.values_count;
+    ok = 1;
+done:
+    fclose(fp);
+    free(recs);
+    return ok;
+}
+
+static void cat_save(const char *path, unsigned int data_version,
+    unsigned int values_count) {
+    cat_rec_t *recs = malloc(cat.num * sizeof(cat_rec_t));
+    if (!recs)
+        return;
+    for (int i = 0; i < cat.num; i++) {
+        const catalog_entry_t *e = &cat.entries[i];
+        recs[i].id = e->id;
+        recs[i].parent = e->parent;
+        recs[i].type = e->type;
+        recs[i].units = e->units;
+        recs[i].name = (unsigned int)(e->name - cat.pool);
+    }
+    cat_hdr_t hdr = {
+        .magic = CAT_MAGIC,
+        .version = CAT_VERSION,
+        .rec_size = sizeof(cat_rec_t),
+        .data_version = data_version,
+        .values_count = values_count,
+        .num = cat.num,
+        .pool_len = cat.pool_len
+    };
+    FILE *fp = fopen(path, "wb");
+    if (fp) {
+        int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            fwrite(recs, sizeof(cat_rec_t), cat.num, fp) == (size_t)cat.num &&
+            fwrite(cat.pool, 1, cat.pool_len, fp) == cat.pool_len;
+        fclose(fp);
+        /* Don't leave a truncated cache behind. */
+        if (!ok)
+            remove(path);
+    }
+    free(recs);
+}
+
+/**
+ * Builds the catalog, or loads it from disk if it was saved for the same
+ * DataVersion and the same set of values before. Must only be called once
+ * the FF API is available.
+ */
+int catalog_init(const ff_api_t *api) {
+    char path[PATH_BUF];
+    unsigned int values_count = 0;
+    long long start = get_time_ns();
+    catalog_deinit();
+    /* Everything that loading, checking or walking the catalog calls. */
+    if (!api->ValuesCount || !api->DataVersion || !api->ValueName ||
+        !api->ValueType || !api->ValueIdByIndex || !api->ValueParent ||
+        !api->ValueUnits) {
+        _log("catalog_init: FF API is incomplete");
+        return 0;
+    }
+    cat.api = api;
+    unsigned int version = api->DataVersion();
+    get_data_path(CAT_FILE, path, sizeof(path));
+    int cached = path[0] && cat_load(path, version, &values_count);
+    if (cached && !cat_verify(values_count)) {
+        log_info("catalog_init: cached catalog is out of date");
+        cached = 0;
+    }
+    if (!cached) {
+        catalog_deinit();
+        cat.api = api;
+        values_count = api->ValuesCount();
+        if (!cat_walk(api)) {
+            _log("catalog_init: could not build catalog");
+            catalog_deinit();
+            return 0;
+        }
+        if (path[0])
+            cat_save(path, version, values_count);
+    }
+    if (!cat_index()) {
+        catalog_deinit();
+        return 0;
+    }
+    log_info("%s %i A320U values in %lli us", cached ? "loaded catalog of" :
+        "indexed", cat.num, (get_time_ns() - start) / 1000);
+    return 1;
+}
+
+void catalog_deinit() {
+    free(cat.entries);
+    free(cat.pool);
+    free(cat.slots);
+    memset(&cat, 0, sizeof(cat));
+}
+
+const catalog_entry_t *catalog_find(const char *name) {
+    if (!cat.num_slots)
+        return NULL;
+    unsigned int k = cat_hash(name) & (cat.num_slots - 1);
+    while (cat.slots[k]) {
+        const catalog_entry_t *e = &cat.entries[cat.slots[k] - 1];
+        if (!strcmp(e->name, name))
+            return e;
+        k = (k + 1) & (cat.num_slots - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Returns the id of the value with the specified path, or -1 if there's no
+ * such value, it is not of the specified Value_Type_ or its id no longer
+ * names it. Pass CATALOG_ANY to accept values of any type.
+ */
+int catalog_id(const char *name, int type) {
+    const catalog_entry_t *e = catalog_find(name);
+    if (!e)
+        return -1;
+    if (!cat_live(e)) {
+        log_info("catalog_id: id %i no longer names %s", e->id, name);
+        return -1;
+    }
+    if (type != CATALOG_ANY && e->type != (unsigned int)type) {
+        _log("catalog_id: %s has type %u, expected %i", name, e->type, type);
+        return -1;
+    }
+    return e->id;
+}
+
+/**
+ * Returns the values whose path starts with the specified prefix, e.g.
+ * "Aircraft.Cockpit.Pedestal." for everything on the pedestal. They are
+ * contiguous and sorted by path, num receives their count.
+ */
+const catalog_entry_t *catalog_prefix(const char *prefix, int *num) {
+    int len = strlen(prefix), lo = 0, hi = cat.num;
+    /* first entry not less than prefix */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(cat.entries[mid].name, prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int end = lo;
+    while (end < cat.num && !strncmp(cat.entries[end].name, prefix, len))
+        end++;
+    *num = end - lo;
+    return *num ? &cat.entries[lo] : NULL;
+}
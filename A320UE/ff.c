@@ -8,48 +8,216 @@
  * Copyright 2019 Torben Knke.
  */
 #include "plugin.h"
+#include <stdlib.h>
 
 static int ff_plugin_id = XPLM_NO_PLUGIN_ID;
 static int ff_loop_reg = 0;
 static ff_api_t ff_api = { 0 };
 static ff_init_done_cb ff_on_done_init = NULL;
 
+/* Frames to poll the FF API on every frame before backing off, and the
+   range the interval then widens over, in seconds. */
+#define FF_POLL_FRAMES      60
+#define FF_POLL_MIN         0.05f
+#define FF_POLL_MAX         1.0f
+
+/**
+ * The FF API only becomes available some time after XPluginEnable, once the
+ * A320U has finished loading. It is polled for on every frame at first and
+ * then less and less often, and additionally asked for right away whenever
+ * X-Plane signals that loading made progress, through ff_poke. The time it
+ * took is logged so it can be compared across setups.
+ */
+static struct {
+    long long start;
+    int tries;
+    /* frames polled since polling (re)started */
+    int frames;
+    float interval;
+    /* profiler slot of the polling loop */
+    int prof_id;
+} ff_poll;
+
+/* Values are read into and written from an 8-byte buffer, which fits
+   every numeric type. */
+typedef union {
+    signed char s8;
+    unsigned char u8;
+    short s16;
+    unsigned short u16;
+    int s32;
+    unsigned int u32;
+    float f32;
+    double f64;
+    long long time;
+} ff_val_t;
+
+/**
+ * Converters between the raw value buffer and float or int, one per
+ * Value_Type_ and indexed by it, so reading a value of a type resolved at
+ * bind time is an indirect call rather than a switch. Entries for
+ * non-numeric types are never reached as binding rejects those.
+ */
+static float f_none(const ff_val_t *v) { return 0; }
+static float f_s8(const ff_val_t *v) { return v->s8; }
+static float f_u8(const ff_val_t *v) { return v->u8; }
+static float f_s16(const ff_val_t *v) { return v->s16; }
+static float f_u16(const ff_val_t *v) { return v->u16; }
+static float f_s32(const ff_val_t *v) { return (float)v->s32; }
+static float f_u32(const ff_val_t *v) { return (float)v->u32; }
+static float f_f32(const ff_val_t *v) { return v->f32; }
+static float f_f64(const ff_val_t *v) { return (float)v->f64; }
+static float f_time(const ff_val_t *v) { return (float)v->time; }
+
+static float(*const to_float[])(const ff_val_t *v) = {
+    f_none, f_none, f_s8, f_u8, f_s16, f_u16, f_s32, f_u32, f_f32, f_f64,
+    f_none, f_time
+};
+
+static int i_none(const ff_val_t *v) { return 0; }
+static int i_s8(const ff_val_t *v) { return v->s8; }
+static int i_u8(const ff_val_t *v) { return v->u8; }
+static int i_s16(const ff_val_t *v) { return v->s16; }
+static int i_u16(const ff_val_t *v) { return v->u16; }
+static int i_s32(const ff_val_t *v) { return v->s32; }
+static int i_u32(const ff_val_t *v) { return (int)v->u32; }
+static int i_f32(const ff_val_t *v) { return (int)v->f32; }
+static int i_f64(const ff_val_t *v) { return (int)v->f64; }
+static int i_time(const ff_val_t *v) { return (int)v->time; }
+
+static int(*const to_int[])(const ff_val_t *v) = {
+    i_none, i_none, i_s8, i_u8, i_s16, i_u16, i_s32, i_u32, i_f32, i_f64,
+    i_none, i_time
+};
+
+static void s_none(ff_val_t *v, double x) { }
+static void s_s8(ff_val_t *v, double x) { v->s8 = (signed char)x; }
+static void s_u8(ff_val_t *v, double x) { v->u8 = (unsigned char)x; }
+static void s_s16(ff_val_t *v, double x) { v->s16 = (short)x; }
+static void s_u16(ff_val_t *v, double x) { v->u16 = (unsigned short)x; }
+static void s_s32(ff_val_t *v, double x) { v->s32 = (int)x; }
+static void s_u32(ff_val_t *v, double x) { v->u32 = (unsigned int)x; }
+static void s_f32(ff_val_t *v, double x) { v->f32 = (float)x; }
+static void s_f64(ff_val_t *v, double x) { v->f64 = x; }
+static void s_time(ff_val_t *v, double x) { v->time = (long long)x; }
+
+static void(*const from_num[])(ff_val_t *v, double x) = {
+    s_none, s_none, s_s8, s_u8, s_s16, s_u16, s_s32, s_u32, s_f32, s_f64,
+    s_none, s_time
+};
+
+/* Size of the value data for each Value_Type_, 0 if it varies. */
+static const unsigned int type_size[] = {
+    0, 0, 1, 1, 2, 2, 4, 4, 4, 8, 0, 8
+};
+
+#define NUM_TYPES (sizeof(type_size) / sizeof(type_size[0]))
+
+/**
+ * Values that modules need every frame are subscribed to once and then
+ * copied into one contiguous block by an update callback that the A320U
+ * invokes in sync with its own update, so reading them is a plain memory
+ * access instead of a call into the FF plugin at some arbitrary point in
+ * the frame. Only numeric values fit into a slot.
+ */
+static struct {
+    ff_val_t vals[FF_MAX_SUBS];
+    int ids[FF_MAX_SUBS];
+    unsigned int types[FF_MAX_SUBS];
+    int num;
+    int registered;
+    int prof_id;
+} ff_snap;
+
+static void ff_update_cb(double step, void *tag) {
+    long long t = prof_begin();
+    for (int i = 0; i < ff_snap.num; i++)
+        ff_api.ValueGet(ff_snap.ids[i], &ff_snap.vals[i]);
+    prof_end(ff_snap.prof_id, t);
+}
+
+/**
+ * Asks the FF plugin for its API. Once it has handed it out, finishes
+ * initialization and returns 1.
+ */
+static int ff_try(const char *trigger) {
+    ff_poll.tries++;
+    XPLMSendMessageToPlugin(ff_plugin_id, XPLM_FF_MSG_GET_SHARED_INTERFACE,
+        &ff_api);
+    /* Keep trying until FF A320 has finished loading and returns a valid
+       data... */
+    if (ff_api.ValuesCount == NULL)
+        return 0;
+    _log("got FF API %lli ms after enable, %i attempts, on %s",
+        (get_time_ns() - ff_poll.start) / 1000000, ff_poll.tries, trigger);
+    /* Once we got the stupid FF interface we can continue with init'ing. */
+    catalog_init(&ff_api);
+    ff_on_done_init();
+    return 1;
+}
+
 int ff_init(ff_init_done_cb cb) {
     ff_on_done_init = cb;
+    memset(&ff_poll, 0, sizeof(ff_poll));
+    ff_poll.start = get_time_ns();
+    ff_poll.prof_id = prof_register("ff_loop_cb");
     ff_plugin_id = XPLMFindPluginBySignature(XPLM_FF_SIGNATURE);
     if (ff_plugin_id == XPLM_NO_PLUGIN_ID) {
         _log("Could not find FF A320 plugin (%s)", XPLM_FF_SIGNATURE);
         return 0;
-    } else {
-        /* Try to get reference to api now. */
-        XPLMSendMessageToPlugin(ff_plugin_id, XPLM_FF_MSG_GET_SHARED_INTERFACE,
-            &ff_api);
-        if (ff_api.ValuesCount == NULL) {
-            ff_loop_reg = 1;
-            XPLMRegisterFlightLoopCallback(ff_loop_cb, 1, NULL);
-        } else {
-            ff_on_done_init();
-        }
+    }
+    /* Try to get reference to api now. */
+    if (!ff_try("enable")) {
+        ff_loop_reg = 1;
+        XPLMRegisterFlightLoopCallback(ff_loop_cb, -1.0f, NULL);
     }
     return 1;
 }
 
-float ff_loop_cb(float last_call, float last_loop, int count, void *data) {
-    if (ff_plugin_id < 0)
+/**
+ * Tries to get the FF API right away if it's still missing, and goes back
+ * to polling on every frame if that didn't work either, as the A320U is
+ * likely about to finish loading.
+ */
+void ff_poke(const char *trigger) {
+    if (ff_plugin_id == XPLM_NO_PLUGIN_ID || ff_api.ValuesCount ||
+        !ff_loop_reg) {
+        return;
+    }
+    if (ff_try(trigger)) {
+        XPLMSetFlightLoopCallbackInterval(ff_loop_cb, 0, 1, NULL);
+        return;
+    }
+    ff_poll.frames = 0;
+    ff_poll.interval = 0;
+    XPLMSetFlightLoopCallbackInterval(ff_loop_cb, -1.0f, 1, NULL);
+}
+
+static float ff_poll_next() {
+    if (ff_plugin_id < 0 || ff_api.ValuesCount)
         return 0;
-    XPLMSendMessageToPlugin(ff_plugin_id, XPLM_FF_MSG_GET_SHARED_INTERFACE,
-        &ff_api);
-    /* Keep trying until FF A320 has finished loading and returns a valid
-       data... */
-    if (ff_api.ValuesCount == NULL)
-        return 1;
-    /* Once we got the stupid FF interface we can continue with init'ing. */
-    ff_on_done_init();
     /* No need to schedule loop again once we're here. */
-    return 0;
+    if (ff_try("poll"))
+        return 0;
+    if (++ff_poll.frames < FF_POLL_FRAMES)
+        return -1.0f;
+    ff_poll.interval = ff_poll.interval == 0 ? FF_POLL_MIN :
+        min(ff_poll.interval * 2, FF_POLL_MAX);
+    return ff_poll.interval;
+}
+
+float ff_loop_cb(float last_call, float last_loop, int count, void *data) {
+    long long t = prof_begin();
+    float next = ff_poll_next();
+    prof_end(ff_poll.prof_id, t);
+    return next;
 }
 
 void ff_deinit() {
+    if (ff_snap.registered && ff_api.DataDelUpdate)
+        ff_api.DataDelUpdate(ff_update_cb, NULL);
+    memset(&ff_snap, 0, sizeof(ff_snap));
+    catalog_deinit();
     if (ff_loop_reg)
         XPLMUnregisterFlightLoopCallback(ff_loop_cb, NULL);
     ff_loop_reg = 0;
@@ -59,35 +227,197 @@ void ff_deinit() {
 }
 
 int ff_get_id(const char *name) {
-    if (!ff_api.ValueIdByName)
-        return -1;
+    int id = catalog_id(name, CATALOG_ANY);
+    if (id >= 0 || !ff_api.ValueIdByName)
+        return id;
+    /* Not in the catalog, e.g. because it couldn't be built or the value
+       was created after it was. */
     return ff_api.ValueIdByName(name);
 }
 
-int ff_get_int(int id) {
+/**
+ * Checks that the value with the specified id is of a type that can be read
+ * as the specified kind, and that its size is what the type implies. Gets
+ * the value's type code on success.
+ */
+static int ff_check(int id, ff_kind_t kind, const char *name,
+    unsigned int *type) {
+    const catalog_entry_t *e = catalog_find(name);
+    /* The id may have come from ValueIdByName if the catalog's was stale. */
+    unsigned int t = e && e->id == id ? e->type : ff_api.ValueType(id);
+    if (kind == FF_STRING) {
+        if (t != Value_Type_String) {
+            _log("ff: %s (%i) is not a string (type %u)", name, id, t);
+            return 0;
+        }
+    } else if (t >= NUM_TYPES || !type_size[t]) {
+        _log("ff: %s (%i) is not numeric (type %u)", name, id, t);
+        return 0;
+    } else {
+        /* Reading it into a buffer sized by type would overrun. */
+        unsigned int size = ff_api.ValueGetSize(id);
+        if (size != type_size[t]) {
+            _log("ff: %s (%i) has size %u, expected %u for type %u", name, id,
+                size, type_size[t], t);
+            return 0;
+        }
+    }
+    *type = t;
+    return 1;
+}
+
+/**
+ * Resolves the value with the specified path and caches its type, so that
+ * accessing it later needs neither a lookup nor any checks. Any mismatch
+ * between the value and the kind of access is reported here, once.
+ */
+int ff_bind(const char *name, ff_kind_t kind, ff_value_t *v) {
+    v->id = -1;
+    v->type = Value_Type_Deleted;
+    v->size = 0;
     if (!ff_api.ValueGet)
         return 0;
-    int retval;
-    ff_api.ValueGet(id, &retval);
-    return retval;
+    int id = ff_get_id(name);
+    if (id < 0) {
+        _log("ff_bind: could not find A320U value %s", name);
+        return 0;
+    }
+    unsigned int type;
+    if (!ff_check(id, kind, name, &type))
+        return 0;
+    v->id = id;
+    v->type = type;
+    v->size = type_size[type] ? type_size[type] : ff_api.ValueGetSize(id);
+    return 1;
 }
 
-void ff_set_int(int id, int val) {
-    if (!ff_api.ValueSet)
-        return;
-    ff_api.ValueSet(id, &val);
+float ff_get_float(const ff_value_t *v) {
+    if (v->id < 0 || !ff_api.ValueGet)
+        return 0;
+    ff_val_t val;
+    ff_api.ValueGet(v->id, &val);
+    return to_float[v->type](&val);
 }
 
-float ff_get_float(int id) {
-    if (!ff_api.ValueGet)
+int ff_get_int(const ff_value_t *v) {
+    if (v->id < 0 || !ff_api.ValueGet)
         return 0;
-    float retval;
-    ff_api.ValueGet(id, &retval);
-    return retval;
+    ff_val_t val;
+    ff_api.ValueGet(v->id, &val);
+    return to_int[v->type](&val);
+}
+
+void ff_set_float(const ff_value_t *v, float x) {
+    if (v->id < 0 || !ff_api.ValueSet)
+        return;
+    ff_val_t val;
+    from_num[v->type](&val, x);
+    ff_api.ValueSet(v->id, &val);
+}
+
+void ff_set_int(const ff_value_t *v, int x) {
+    if (v->id < 0 || !ff_api.ValueSet)
+        return;
+    ff_val_t val;
+    from_num[v->type](&val, x);
+    ff_api.ValueSet(v->id, &val);
+}
+
+/**
+ * Copies a string value into buf, truncating it if necessary. Returns the
+ * length of the string copied, or -1 on failure.
+ */
+int ff_get_string(const ff_value_t *v, char *buf, int size) {
+    if (size <= 0)
+        return -1;
+    buf[0] = '\0';
+    if (v->id < 0 || !ff_api.ValueGet)
+        return -1;
+    unsigned int len = ff_api.ValueGetSize(v->id);
+    char *tmp = buf;
+    /* ValueGet copies all of it, so give it enough room. */
+    if (len >= (unsigned int)size && !(tmp = malloc(len + 1)))
+        return -1;
+    ff_api.ValueGet(v->id, tmp);
+    tmp[len] = '\0';
+    if (tmp != buf) {
+        memcpy(buf, tmp, size - 1);
+        buf[size - 1] = '\0';
+        free(tmp);
+    }
+    return (int)strlen(buf);
 }
 
-void ff_set_float(int id, float val) {
-    if (!ff_api.ValueSet)
+/**
+ * Copies the raw data of a bound value into buf, which must be able to hold
+ * v->size bytes. No conversion takes place. buf is left untouched if the
+ * value isn't bound or the FF API is gone.
+ */
+void ff_read(const ff_value_t *v, void *buf) {
+    if (v->id < 0 || !ff_api.ValueGet)
         return;
-    ff_api.ValueSet(id, &val);
+    ff_api.ValueGet(v->id, buf);
+}
+
+/**
+ * Registers a callback that the A320U invokes in sync with its own update,
+ * in addition to the one that refreshes subscribed values.
+ */
+int ff_add_update(SharedDataUpdateProc cb, void *tag) {
+    if (!ff_api.DataAddUpdate) {
+        _log("ff_add_update: FF API has no DataAddUpdate");
+        return 0;
+    }
+    ff_api.DataAddUpdate(cb, tag);
+    return 1;
+}
+
+void ff_del_update(SharedDataUpdateProc cb, void *tag) {
+    if (ff_api.DataDelUpdate)
+        ff_api.DataDelUpdate(cb, tag);
+}
+
+/**
+ * Adds a value bound with ff_bind to the per-frame snapshot. It was checked
+ * when it was bound, so only numeric values are accepted here. Returns the
+ * slot to pass to ff_snap_float and ff_snap_int, or -1 on failure.
+ */
+int ff_subscribe(const ff_value_t *v) {
+    if (v->id < 0 || !ff_api.ValueGet)
+        return -1;
+    for (int i = 0; i < ff_snap.num; i++) {
+        if (ff_snap.ids[i] == v->id)
+            return i;
+    }
+    if (v->type >= NUM_TYPES || !type_size[v->type]) {
+        _log("ff_subscribe: value %i is not numeric", v->id);
+        return -1;
+    }
+    if (ff_snap.num >= FF_MAX_SUBS) {
+        _log("ff_subscribe: too many values, can't add %i", v->id);
+        return -1;
+    }
+    if (!ff_snap.registered) {
+        if (!ff_api.DataAddUpdate) {
+            _log("ff_subscribe: FF API lacks DataAddUpdate");
+            return -1;
+        }
+        ff_snap.prof_id = prof_register("ff_update_cb");
+        ff_api.DataAddUpdate(ff_update_cb, NULL);
+        ff_snap.registered = 1;
+    }
+    int slot = ff_snap.num++;
+    ff_snap.ids[slot] = v->id;
+    ff_snap.types[slot] = v->type;
+    /* Don't hand out garbage until the first update comes around. */
+    ff_api.ValueGet(v->id, &ff_snap.vals[slot]);
+    return slot;
+}
+
+float ff_snap_float(int slot) {
+    return to_float[ff_snap.types[slot]](&ff_snap.vals[slot]);
+}
+
+int ff_snap_int(int slot) {
+    return to_int[ff_snap.types[slot]](&ff_snap.vals[slot]);
 }
@@ -0,0 +1,59 @@
+/**
+ * A320UE - X-Plane 11 Plugin
+ *
+ * A plugin for the FlightFactor A320 Ultimate that adds a couple of new
+ * commands for operating the thrust levers more comfortably as well as a
+ * bunch of other little workarounds and/or features.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#ifndef _FFREC_H_
+#define _FFREC_H_
+
+/**
+ * Layout of a capture written by the recorder, shared with the offline
+ * converter in tools/ffrec.c. A capture is a header followed by a ring of
+ * capacity fixed-width records. Each record starts with ffrec_stamp_t,
+ * followed by the raw bytes of every column at the column's offset, so a
+ * column is always at the same place in every record. Records are written
+ * in order and wrap around once the ring is full; written counts all
+ * records ever written, so the oldest one still in the ring is record
+ * written % capacity once written exceeds capacity.
+ */
+#define FFREC_MAGIC         0x31524646 /* FFR1 */
+#define FFREC_VERSION       1
+#define FFREC_MAX_COLS      64
+#define FFREC_NAME_SIZE     96
+
+typedef struct {
+    /* full dotted path of the A320U value */
+    char name[FFREC_NAME_SIZE];
+    int id;
+    /* Value_Type_ */
+    unsigned int type;
+    unsigned int size;
+    /* byte offset into the record */
+    unsigned int offset;
+} ffrec_col_t;
+
+typedef struct {
+    /* monotonic clock in nanoseconds */
+    long long time_ns;
+    /* sum of the update steps passed by the A320U */
+    double sim_time;
+} ffrec_stamp_t;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int num_cols;
+    unsigned int rec_size;
+    unsigned int capacity;
+    /* byte offset of the first record */
+    unsigned int data_offset;
+    /* updated after each record has been written */
+    volatile unsigned long long written;
+    ffrec_col_t cols[FFREC_MAX_COLS];
+} ffrec_hdr_t;
+
+#endif /* _FFREC_H_ */
@@ -28,14 +28,19 @@ static lever_cmd_t lever_cmds[] = {
       levers_next_step, 0, NULL }
 };
 
-static int lever_id;
+static ff_value_t lever_val;
+/* snapshot slot of the engine lever */
+static int lever_slot;
 static XPLMDataRef dr_throttle;
-static snd_t click_sound;
 static int thrust_inc_delay;
 static int thrust_inc_speed;
 static int thrust_detent_stop;
 static int thrust_show_hints;
 static int draw_cb_registered;
+/* profiler slots */
+static int prof_detent;
+static int prof_step;
+static int prof_draw;
 
 #define THRUST_INC_SPEED     6 /* per second */
 #define THRUST_INC_DELAY   500 /* ms */
@@ -54,9 +59,16 @@ static int draw_cb_registered;
 #define DATAREF_THROTTLE "a320/throttleComm"
 
 void levers_init() {
-    lever_id = ff_get_id(ENGINE_LEVER_ONE);
-    if (lever_id < 0) {
-        _log("init fail: could not find A320U object %s", ENGINE_LEVER_ONE);
+    prof_detent = prof_register("levers_next_detent");
+    prof_step = prof_register("levers_next_step");
+    prof_draw = prof_register("levers_draw_cb");
+    if (!ff_bind(ENGINE_LEVER_ONE, FF_NUMERIC, &lever_val)) {
+        _log("init fail: could not bind A320U object %s", ENGINE_LEVER_ONE);
+        return;
+    }
+    lever_slot = ff_subscribe(&lever_val);
+    if (lever_slot < 0) {
+        _log("init fail: could not subscribe to %s", ENGINE_LEVER_ONE);
         return;
     }
     dr_throttle = XPLMFindDataRef(DATAREF_THROTTLE);
@@ -64,11 +76,8 @@ void levers_init() {
         _log("init fail: could not find data-ref %s", DATAREF_THROTTLE);
         return;
     }
-    char path[MAX_PATH];
-    get_data_path("a320_detent_click.wav", path, MAX_PATH);
-    if (!(click_sound = snd_create(path))) {
-        _log("init warn: could not create sound (%s)", path);
-    }
+    if (sound_ids[SOUND_DETENT_CLICK] < 0)
+        _log("init warn: detent click sound not available");
     /* create and install command handlers */
     for (int i = 0; i < sizeof(lever_cmds) / sizeof(lever_cmds[0]); i++) {
         lever_cmds[i].cmd = cmd_create(
@@ -95,10 +104,6 @@ void levers_deinit() {
             lever_cmds[i].ref
         );
     }
-    /* need to free sound memory */
-    if (click_sound)
-        snd_free(click_sound);
-    click_sound = NULL;
     _log("unregistered A320UE lever commands");
 }
 
@@ -125,15 +130,15 @@ static int num_lever_detents = sizeof(lever_detents) / sizeof(lever_detents[0]);
 static void levers_set_pos(float pos, const char *message, int sound) {
     XPLMSetDataf(dr_throttle, pos);
     if(sound)
-        snd_play(click_sound, SND_VOL_INTERIOR);
+        snd_bank_play(sound_ids[SOUND_DETENT_CLICK], SND_VOL_INTERIOR);
     if (message && thrust_show_hints)
         levers_draw_string(message);
 }
 
-int levers_next_detent(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
+static int next_detent(XPLMCommandPhase phase, void *ref) {
     if (phase != xplm_CommandBegin)
         return 0;
-    float lever_pos = ff_get_float(lever_id);
+    float lever_pos = ff_snap_float(lever_slot);
     /* move forward into next detent position */
     if (ref) {
         for (int i = 0; i < num_lever_detents; i++) {
@@ -163,6 +168,13 @@ int levers_next_detent(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
     return 0;
 }
 
+int levers_next_detent(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
+    long long t = prof_begin();
+    int ret = next_detent(phase, ref);
+    prof_end(prof_detent, t);
+    return ret;
+}
+
 static int levers_in_detent(float pos) {
     const float threshold = 0.05f;
     for (int i = 0; i < num_lever_detents; i++) {
@@ -177,10 +189,10 @@ static long long step_start_time;
 static long long step_last_time;
 static int  step_stop;
 
-int levers_next_step(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
+static int next_step(XPLMCommandPhase phase, void *ref) {
     float pos = XPLMGetDataf(dr_throttle);
     float amt = 0.05f; /* initial amount */
-    long long now = get_time_ms();
+    long long now = get_frame_time_ms();
     int before = levers_in_detent(pos);
     switch (phase) {
     case xplm_CommandBegin:
@@ -223,20 +235,29 @@ int levers_next_step(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
     return 1;
 }
 
+int levers_next_step(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
+    long long t = prof_begin();
+    int ret = next_step(phase, ref);
+    prof_end(prof_step, t);
+    return ret;
+}
+
 static char levers_message[128];
 static long long levers_message_timeout;
 static int screen_height;
 static float cyan[] = { 0, 1.0f, 1.0f };
 int draw_cb(XPLMDrawingPhase phase, int before, void *ref) {
+    long long t = prof_begin();
     /* show a text indication in top left corner of screen */
-    if (levers_message_timeout < get_time_ms()) {
+    if (levers_message_timeout < get_frame_time_ms()) {
         /* if not drawing anything might as well unregister the callback */
         XPLMUnregisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
         draw_cb_registered = 0;
-        return 1;
+    } else {
+        XPLMDrawString(cyan, 20, screen_height - 50, (char*)levers_message,
+            NULL, xplmFont_Proportional);
     }
-    XPLMDrawString(cyan, 20, screen_height - 50, (char*)levers_message, NULL,
-        xplmFont_Proportional);
+    prof_end(prof_draw, t);
     return 1;
 }
 
@@ -246,5 +267,5 @@ void levers_draw_string(const char *s) {
         draw_cb_registered = XPLMRegisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
     }
     strncpy(levers_message, s, sizeof(levers_message));
-    levers_message_timeout = get_time_ms() + 3000;
+    levers_message_timeout = get_frame_time_ms() + 3000;
 }
@@ -15,6 +15,13 @@
                             "make the FF A320U even more enjoyable to fly."
 #define PLUGIN_VERSION      "1.1"
 
+/* Sound bank manifest, indexed by sound_t. */
+static const char *sound_files[NUM_SOUNDS] = {
+    "a320_detent_click.wav",
+    "a320_v_one.wav"
+};
+int sound_ids[NUM_SOUNDS];
+
 /**
  * X-Plane 11 Plugin Entry Point.
  *
@@ -27,6 +34,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
+    path_init();
 #ifdef APL
     XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
 #endif
@@ -39,7 +47,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
  * Called when the plugin is about to be unloaded from X-Plane 11.
  */
 PLUGIN_API void XPluginStop(void) {
-    /* nothing to do here */
+    log_deinit();
 }
 
 /**
@@ -52,6 +60,7 @@ PLUGIN_API int XPluginEnable(void) {
     /* This is really lame, we get called too early in the process when the
        FF API hasn't been initialized yet, so we have to keep polling until
        it is and then continue with the rest of our initialization. */
+    prof_init();
     return ff_init(plugin_init);
 }
 
@@ -63,6 +72,7 @@ PLUGIN_API int XPluginEnable(void) {
 PLUGIN_API void XPluginDisable(void) {
     /* clean up */
     plugin_deinit();
+    prof_deinit();
 }
 
 /**
@@ -71,6 +81,15 @@ PLUGIN_API void XPluginDisable(void) {
  * Called when a message is sent to the plugin by X-Plane 11 or another plugin.
  */
 PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
+    if (from != XPLM_PLUGIN_XPLANE)
+        return;
+    /* The FF API usually becomes available right around when loading the
+       aircraft or the scenery has finished, so don't wait for the next
+       poll. */
+    if (msg == XPLM_MSG_PLANE_LOADED && (intptr_t)param == XPLM_USER_AIRCRAFT)
+        ff_poke("plane loaded");
+    else if (msg == XPLM_MSG_AIRPORT_LOADED)
+        ff_poke("airport loaded");
 }
 
 /**
@@ -80,12 +99,19 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
  * their provided functions for manipulating A320U values.
  */
 void plugin_init() {
+    time_init();
     snd_init();
+    /* Decode all samples up-front so playing them back is cheap. */
+    snd_bank_load(sound_files, sound_ids, NUM_SOUNDS);
     levers_init();
     v1_init();
+    recorder_init();
 }
 
 void plugin_deinit() {
+    /* Must stop recording before the FF API goes away. */
+    recorder_deinit();
+    time_deinit();
     snd_deinit();
     ff_deinit();
     levers_deinit();
@@ -22,20 +22,66 @@
 #include <math.h>
 
 /* plugin */
+typedef enum {
+    SOUND_DETENT_CLICK,
+    SOUND_V_ONE,
+    NUM_SOUNDS
+} sound_t;
+extern int sound_ids[NUM_SOUNDS];
 void plugin_init();
 void plugin_deinit();
 
 /* ff */
+#define FF_MAX_SUBS 32
 typedef SharedValuesInterface ff_api_t;
 typedef void(*ff_init_done_cb)();
 int ff_init(ff_init_done_cb cb);
 void ff_deinit();
 float ff_loop_cb(float last_call, float last_loop, int count, void *data);
+void ff_poke(const char *trigger);
+typedef enum {
+    FF_NUMERIC,
+    FF_STRING
+} ff_kind_t;
+/* A value resolved by ff_bind. */
+typedef struct {
+    int id;
+    unsigned int type;
+    /* size of the value data in bytes */
+    unsigned int size;
+} ff_value_t;
 int ff_get_id(const char *name);
-int ff_get_int(int id);
-void ff_set_int(int id, int val);
-float ff_get_float(int id);
-void ff_set_float(int id, float val);
+int ff_bind(const char *name, ff_kind_t kind, ff_value_t *v);
+float ff_get_float(const ff_value_t *v);
+int ff_get_int(const ff_value_t *v);
+void ff_set_float(const ff_value_t *v, float x);
+void ff_set_int(const ff_value_t *v, int x);
+int ff_get_string(const ff_value_t *v, char *buf, int size);
+void ff_read(const ff_value_t *v, void *buf);
+int ff_add_update(SharedDataUpdateProc cb, void *tag);
+void ff_del_update(SharedDataUpdateProc cb, void *tag);
+int ff_subscribe(const ff_value_t *v);
+float ff_snap_float(int slot);
+int ff_snap_int(int slot);
+
+/* catalog */
+#define CATALOG_ANY -1
+typedef struct {
+    /* full dotted path, e.g. Aircraft.Cockpit.Pedestal.EngineLever1 */
+    const char *name;
+    int id;
+    /* catalog index of the parent object, or -1 */
+    int parent;
+    /* Value_Type_ */
+    unsigned int type;
+    /* Value_Unit_ flags */
+    unsigned int units;
+} catalog_entry_t;
+int catalog_init(const ff_api_t *api);
+void catalog_deinit();
+const catalog_entry_t *catalog_find(const char *name);
+int catalog_id(const char *name, int type);
+const catalog_entry_t *catalog_prefix(const char *prefix, int *num);
 
 /* levers */
 void levers_init();
@@ -44,6 +90,10 @@ int levers_next_detent(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon)
 int levers_next_step(XPLMCommandRef cmd, XPLMCommandPhase phase, void *refcon);
 void levers_draw_string(const char *s);
 
+/* recorder */
+void recorder_init();
+void recorder_deinit();
+
 /* v1 */
 void v1_init();
 void v1_deinit();
@@ -0,0 +1,188 @@
+/**
+ * A320UE - X-Plane 11 Plugin
+ *
+ * A plugin for the FlightFactor A320 Ultimate that adds a couple of new
+ * commands for operating the thrust levers more comfortably as well as a
+ * bunch of other little workarounds and/or features.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+#include "ffrec.h"
+#include <time.h>
+
+#define RECORD_CAPACITY     65536
+#define RECORD_CMD          "A320UE/ToggleRecorder"
+
+/**
+ * Records a configurable set of A320U values on every update of the A320U
+ * into a ring of fixed-width records in a memory-mapped capture file, for
+ * looking at lever and autothrust behaviour afterwards. The file is sized
+ * up-front and values are copied into it raw, so sampling neither
+ * allocates nor formats anything; tools/ffrec.c turns a capture into CSV
+ * or one file per column.
+ *
+ * Values are listed in the record_values setting, separated by commas.
+ * An entry ending in a dot, e.g. "Aircraft.Cockpit.Pedestal.", records
+ * all numeric values below that object.
+ */
+static struct {
+    XPLMCommandRef cmd;
+    ff_value_t vals[FFREC_MAX_COLS];
+    char names[FFREC_MAX_COLS][FFREC_NAME_SIZE];
+    int num_cols;
+    unsigned int capacity;
+    fmap_t map;
+    ffrec_hdr_t *hdr;
+    unsigned char *data;
+    unsigned int index;
+    double sim_time;
+    int prof_id;
+} rec;
+
+static int rec_is_numeric(unsigned int type) {
+    return (type >= Value_Type_sint8 && type <= Value_Type_float64) ||
+        type == Value_Type_Time;
+}
+
+static void rec_add(const char *name) {
+    if (rec.num_cols >= FFREC_MAX_COLS) {
+        _log("recorder: too many values, can't add %s", name);
+        return;
+    }
+    if (!ff_bind(name, FF_NUMERIC, &rec.vals[rec.num_cols]))
+        return;
+    snprintf(rec.names[rec.num_cols], FFREC_NAME_SIZE, "%s", name);
+    rec.num_cols++;
+}
+
+static void rec_parse(const char *list) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *s = strtok(buf, ", \t"); s; s = strtok(NULL, ", \t")) {
+        int num, len = strlen(s);
+        if (s[len - 1] != '.') {
+            rec_add(s);
+            continue;
+        }
+        const catalog_entry_t *e = catalog_prefix(s, &num);
+        for (int i = 0; i < num; i++) {
+            if (rec_is_numeric(e[i].type))
+                rec_add(e[i].name);
+        }
+        if (!num)
+            _log("recorder: no A320U values below %s", s);
+    }
+}
+
+static void rec_update_cb(double step, void *tag) {
+    long long t = prof_begin();
+    unsigned char *r = rec.data + (size_t)rec.index * rec.hdr->rec_size;
+    ffrec_stamp_t *stamp = (ffrec_stamp_t*)r;
+    rec.sim_time += step;
+    stamp->time_ns = get_time_ns();
+    stamp->sim_time = rec.sim_time;
+    for (int i = 0; i < rec.num_cols; i++)
+        ff_read(&rec.vals[i], r + rec.hdr->cols[i].offset);
+    if (++rec.index >= rec.capacity)
+        rec.index = 0;
+    /* Only count the record once all of it is in place. */
+    rec.hdr->written++;
+    prof_end(rec.prof_id, t);
+}
+
+static int rec_start() {
+    char name[64], path[PATH_BUF];
+    ffrec_hdr_t hdr = {
+        .magic = FFREC_MAGIC,
+        .version = FFREC_VERSION,
+        .num_cols = rec.num_cols,
+        .capacity = rec.capacity,
+        .data_offset = sizeof(ffrec_hdr_t)
+    };
+    /* Columns at offsets aligned to their size, records to 8 bytes. */
+    unsigned int off = sizeof(ffrec_stamp_t);
+    for (int i = 0; i < rec.num_cols; i++) {
+        const ff_value_t *v = &rec.vals[i];
+        ffrec_col_t *c = &hdr.cols[i];
+        off = (off + v->size - 1) & ~(v->size - 1);
+        snprintf(c->name, sizeof(c->name), "%s", rec.names[i]);
+        c->id = v->id;
+        c->type = v->type;
+        c->size = v->size;
+        c->offset = off;
+        off += v->size;
+    }
+    hdr.rec_size = (off + 7) & ~7u;
+    /* Keep the file below 2 GB. */
+    hdr.capacity = min(rec.capacity, (0x7FFFFFFFu - hdr.data_offset) /
+        hdr.rec_size);
+    time_t t = time(NULL);
+    strftime(name, sizeof(name), "ff_rec_%Y%m%d_%H%M%S.bin", localtime(&t));
+    if (!get_data_path(name, path, sizeof(path)))
+        return 0;
+    rec.map = fmap_create(path, hdr.data_offset + hdr.rec_size *
+        hdr.capacity);
+    if (!rec.map)
+        return 0;
+    rec.hdr = fmap_ptr(rec.map);
+    memcpy(rec.hdr, &hdr, sizeof(hdr));
+    rec.data = (unsigned char*)rec.hdr + hdr.data_offset;
+    rec.capacity = hdr.capacity;
+    rec.index = 0;
+    rec.sim_time = 0;
+    if (!ff_add_update(rec_update_cb, NULL)) {
+        fmap_close(rec.map);
+        rec.map = NULL;
+        return 0;
+    }
+    _log("recording %i A320U values to '%s'", rec.num_cols, path);
+    return 1;
+}
+
+static void rec_stop() {
+    if (!rec.map)
+        return;
+    ff_del_update(rec_update_cb, NULL);
+    _log("recorded %llu updates", rec.hdr->written);
+    fmap_close(rec.map);
+    rec.map = NULL;
+    rec.hdr = NULL;
+    rec.data = NULL;
+}
+
+static int rec_toggle_cb(XPLMCommandRef cmd, XPLMCommandPhase phase,
+    void *ref) {
+    if (phase != xplm_CommandBegin)
+        return 1;
+    if (rec.map)
+        rec_stop();
+    else
+        rec_start();
+    return 1;
+}
+
+void recorder_init() {
+    char list[1024];
+    ini_gets("record_values", list, sizeof(list), "");
+    /* Nothing to record, so don't offer to. */
+    if (!list[0])
+        return;
+    rec_parse(list);
+    if (!rec.num_cols) {
+        _log("init fail: none of the values to record were found");
+        return;
+    }
+    rec.capacity = max(ini_geti("record_capacity", RECORD_CAPACITY), 1);
+    rec.prof_id = prof_register("rec_update_cb");
+    rec.cmd = cmd_create(RECORD_CMD, "Start/stop recording A320U values",
+        rec_toggle_cb, NULL);
+    _log("initialized recorder with %i values", rec.num_cols);
+}
+
+void recorder_deinit() {
+    rec_stop();
+    if (rec.cmd)
+        cmd_free(rec.cmd, rec_toggle_cb, NULL);
+    memset(&rec, 0, sizeof(rec));
+}
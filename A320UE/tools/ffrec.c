@@ -0,0 +1,232 @@
+/**
+ * A320UE - X-Plane 11 Plugin
+ *
+ * A plugin for the FlightFactor A320 Ultimate that adds a couple of new
+ * commands for operating the thrust levers more comfortably as well as a
+ * bunch of other little workarounds and/or features.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include "../a320.h"
+#include "../ffrec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Offline converter for captures written by the A320UE recorder. Doesn't
+ * depend on X-Plane and builds on its own, e.g. with cc -o ffrec ffrec.c.
+ *
+ *   ffrec <capture> csv [file]    writes all records as CSV, to stdout if
+ *                                 no file is given
+ *   ffrec <capture> cols <dir>    writes every column into a file of its
+ *                                 own holding a plain little-endian array,
+ *                                 described by <dir>/columns.csv
+ *
+ * Either way records come out oldest first.
+ */
+typedef struct {
+    ffrec_hdr_t hdr;
+    unsigned char *data;
+    /* ring index of the oldest record and number of records */
+    unsigned int first;
+    unsigned int num;
+} capture_t;
+
+static const char *type_names[] = {
+    "deleted", "object", "int8", "uint8", "int16", "uint16", "int32",
+    "uint32", "float32", "float64", "string", "time"
+};
+
+/* Size of each type print_value handles, indexed by Value_Type_, 0 for
+   the others. */
+static const unsigned int type_sizes[] = {
+    0, 0, 1, 1, 2, 2, 4, 4, 4, 8, 0, 8
+};
+
+#define NUM_TYPES (sizeof(type_sizes) / sizeof(type_sizes[0]))
+
+static int load(const char *path, capture_t *c) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "could not open '%s'\n", path);
+        return 0;
+    }
+    int ok = 0;
+    if (fread(&c->hdr, sizeof(c->hdr), 1, fp) != 1 ||
+        c->hdr.magic != FFREC_MAGIC || c->hdr.version != FFREC_VERSION) {
+        fprintf(stderr, "'%s' is not a capture\n", path);
+        goto done;
+    }
+    if (c->hdr.num_cols > FFREC_MAX_COLS || !c->hdr.capacity ||
+        c->hdr.rec_size < sizeof(ffrec_stamp_t)) {
+        fprintf(stderr, "'%s' has a bad header\n", path);
+        goto done;
+    }
+    for (unsigned int i = 0; i < c->hdr.num_cols; i++) {
+        ffrec_col_t *col = &c->hdr.cols[i];
+        col->name[sizeof(col->name) - 1] = '\0';
+        /* Written this way round so that a huge offset can't wrap. */
+        if (col->type >= NUM_TYPES || !type_sizes[col->type] ||
+            col->size != type_sizes[col->type] ||
+            col->size > c->hdr.rec_size ||
+            col->offset > c->hdr.rec_size - col->size) {
+            fprintf(stderr, "'%s' has a bad column %u\n", path, i);
+            goto done;
+        }
+    }
+    unsigned long long written = c->hdr.written;
+    c->num = written < c->hdr.capacity ? (unsigned int)written :
+        c->hdr.capacity;
+    c->first = written < c->hdr.capacity ? 0 :
+        (unsigned int)(written % c->hdr.capacity);
+    size_t size = (size_t)c->hdr.rec_size * c->hdr.capacity;
+    if (!(c->data = malloc(size ? size : 1))) {
+        fprintf(stderr, "out of memory\n");
+        goto done;
+    }
+    if (fseek(fp, c->hdr.data_offset, SEEK_SET) ||
+        fread(c->data, 1, size, fp) != size) {
+        fprintf(stderr, "'%s' is truncated\n", path);
+        goto done;
+    }
+    ok = 1;
+done:
+    fclose(fp);
+    return ok;
+}
+
+static const unsigned char *record(const capture_t *c, unsigned int i) {
+    return c->data + (size_t)((c->first + i) % c->hdr.capacity) *
+        c->hdr.rec_size;
+}
+
+static void print_value(FILE *fp, unsigned int type, const unsigned char *p) {
+    signed char s8; unsigned char u8; short s16; unsigned short u16;
+    int s32; unsigned int u32; float f32; double f64; long long s64;
+    switch (type) {
+    case Value_Type_sint8:
+        memcpy(&s8, p, 1);
+        fprintf(fp, "%d", s8);
+        break;
+    case Value_Type_uint8:
+        memcpy(&u8, p, 1);
+        fprintf(fp, "%u", u8);
+        break;
+    case Value_Type_sint16:
+        memcpy(&s16, p, 2);
+        fprintf(fp, "%d", s16);
+        break;
+    case Value_Type_uint16:
+        memcpy(&u16, p, 2);
+        fprintf(fp, "%u", u16);
+        break;
+    case Value_Type_sint32:
+        memcpy(&s32, p, 4);
+        fprintf(fp, "%d", s32);
+        break;
+    case Value_Type_uint32:
+        memcpy(&u32, p, 4);
+        fprintf(fp, "%u", u32);
+        break;
+    case Value_Type_float32:
+        memcpy(&f32, p, 4);
+        fprintf(fp, "%.9g", f32);
+        break;
+    case Value_Type_float64:
+        memcpy(&f64, p, 8);
+        fprintf(fp, "%.17g", f64);
+        break;
+    case Value_Type_Time:
+        memcpy(&s64, p, 8);
+        fprintf(fp, "%lld", s64);
+        break;
+    }
+}
+
+static int write_csv(const capture_t *c, const char *path) {
+    FILE *fp = path ? fopen(path, "w") : stdout;
+    if (!fp) {
+        fprintf(stderr, "could not create '%s'\n", path);
+        return 0;
+    }
+    fprintf(fp, "time_ns,sim_time");
+    for (unsigned int i = 0; i < c->hdr.num_cols; i++)
+        fprintf(fp, ",%s", c->hdr.cols[i].name);
+    fprintf(fp, "\n");
+    for (unsigned int n = 0; n < c->num; n++) {
+        const unsigned char *r = record(c, n);
+        ffrec_stamp_t stamp;
+        memcpy(&stamp, r, sizeof(stamp));
+        fprintf(fp, "%lld,%.6f", stamp.time_ns, stamp.sim_time);
+        for (unsigned int i = 0; i < c->hdr.num_cols; i++) {
+            const ffrec_col_t *col = &c->hdr.cols[i];
+            fputc(',', fp);
+            print_value(fp, col->type, r + col->offset);
+        }
+        fputc('\n', fp);
+    }
+    if (fp != stdout)
+        fclose(fp);
+    return 1;
+}
+
+static int write_column(const capture_t *c, const char *dir, const char *name,
+    unsigned int offset, unsigned int size) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.bin", dir, name);
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "could not create '%s'\n", path);
+        return 0;
+    }
+    for (unsigned int n = 0; n < c->num; n++)
+        fwrite(record(c, n) + offset, size, 1, fp);
+    fclose(fp);
+    return 1;
+}
+
+static int write_cols(const capture_t *c, const char *dir) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/columns.csv", dir);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "could not create '%s'\n", path);
+        return 0;
+    }
+    fprintf(fp, "file,name,type,size,rows\n");
+    fprintf(fp, "time_ns.bin,time_ns,int64,8,%u\n", c->num);
+    fprintf(fp, "sim_time.bin,sim_time,float64,8,%u\n", c->num);
+    int ok = write_column(c, dir, "time_ns", 0, 8) &&
+        write_column(c, dir, "sim_time", 8, 8);
+    for (unsigned int i = 0; ok && i < c->hdr.num_cols; i++) {
+        const ffrec_col_t *col = &c->hdr.cols[i];
+        char file[32];
+        /* Value paths make for unwieldy file names. */
+        snprintf(file, sizeof(file), "col%02u", i);
+        fprintf(fp, "%s.bin,%s,%s,%u,%u\n", file, col->name,
+            type_names[col->type], col->size, c->num);
+        ok = write_column(c, dir, file, col->offset, col->size);
+    }
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    capture_t c = { 0 };
+    if (argc < 3 || (strcmp(argv[2], "csv") && strcmp(argv[2], "cols")) ||
+        (!strcmp(argv[2], "cols") && argc < 4)) {
+        fprintf(stderr, "usage: ffrec <capture> csv [file]\n"
+            "       ffrec <capture> cols <dir>\n");
+        return 2;
+    }
+    if (!load(argv[1], &c))
+        return 1;
+    fprintf(stderr, "%u columns, %u of %llu records\n", c.hdr.num_cols,
+        c.num, (unsigned long long)c.hdr.written);
+    int ok = !strcmp(argv[2], "csv") ? write_csv(&c, argc > 3 ? argv[3] :
+        NULL) : write_cols(&c, argv[3]);
+    free(c.data);
+    return ok ? 0 : 1;
+}
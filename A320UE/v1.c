@@ -10,34 +10,39 @@
 #include "plugin.h"
 
 #define V1_CALLOUT      1
-#define V1_SOUND        "a320_v_one.wav"
 #define A320U_V1_SPEED  "Aircraft.TakeoffDecision"
 #define A320U_AIRSPEED  "Aircraft.AirSpeed"
 
-static int v1_id;
-static int airspeed_id;
+static ff_value_t v1_val;
+static ff_value_t airspeed_val;
+/* snapshot slots */
+static int v1_slot;
+static int airspeed_slot;
 static XPLMFlightLoopID loop_id;
-static snd_t v1_sound;
+static int prof_loop;
 
 void v1_init() {
     /* If it's not enabled, we don't need to set up anything in the
        first place. */
     if (!ini_geti("v1_callout", V1_CALLOUT))
         return;
-    v1_id = ff_get_id(A320U_V1_SPEED);
-    if (v1_id < 0) {
-        _log("init fail: could not find A320U object %s", A320U_V1_SPEED);
+    prof_loop = prof_register("v1_loop_cb");
+    if (!ff_bind(A320U_V1_SPEED, FF_NUMERIC, &v1_val)) {
+        _log("init fail: could not bind A320U object %s", A320U_V1_SPEED);
         return;
     }
-    airspeed_id = ff_get_id(A320U_AIRSPEED);
-    if (airspeed_id < 0) {
-        _log("init fail: could not find A320U object %s", A320U_AIRSPEED);
+    if (!ff_bind(A320U_AIRSPEED, FF_NUMERIC, &airspeed_val)) {
+        _log("init fail: could not bind A320U object %s", A320U_AIRSPEED);
         return;
     }
-    char path[MAX_PATH];
-    get_data_path(V1_SOUND, path, MAX_PATH);
-    if (!(v1_sound = snd_create(path))) {
-        _log("init fail: could not create sound (%s)", path);
+    v1_slot = ff_subscribe(&v1_val);
+    airspeed_slot = ff_subscribe(&airspeed_val);
+    if (v1_slot < 0 || airspeed_slot < 0) {
+        _log("init fail: could not subscribe to v1 and airspeed");
+        return;
+    }
+    if (sound_ids[SOUND_V_ONE] < 0) {
+        _log("init fail: v1 callout sound not available");
         return;
     }
     /* Register and schedule flightloop. */
@@ -53,25 +58,25 @@ void v1_init() {
 }
 
 float v1_loop_cb(float last_call, float last_loop, int count, void *data) {
-    float ias = ff_get_float(airspeed_id);
+    long long t = prof_begin();
+    /* It's probably enough to call us back every once in a while. */
+    float next = -10.0f;
+    float ias = ff_snap_float(airspeed_slot);
     if (ias > 40) {
-        float v1 = ff_get_float(v1_id);
+        float v1 = ff_snap_float(v1_slot);
         if (ias >= v1) {
-            snd_play(v1_sound, SND_VOL_INTERIOR);
+            snd_bank_play(sound_ids[SOUND_V_ONE], SND_VOL_INTERIOR);
             /* Don't need to call us back anymore after this. */
-            return 0;
+            next = 0;
         }
     }
-    /* It's probably enough to call us back every once in a while. */
-    return -10.0f;
+    prof_end(prof_loop, t);
+    return next;
 }
 
 void v1_deinit() {
     if (loop_id)
         XPLMDestroyFlightLoop(loop_id);
     loop_id = NULL;
-    if (v1_sound)
-        snd_free(v1_sound);
-    v1_sound = NULL;
     _log("deinitialized v1 module");
 }
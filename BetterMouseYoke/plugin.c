@@ -8,6 +8,7 @@
  * Copyright 2019 Torben Knke.
  */
 #include "plugin.h"
+#include <math.h>
 
 #define PLUGIN_NAME         "BetterMouseYoke"
 #define PLUGIN_SIG          "S22.BetterMouseYoke"
@@ -18,11 +19,14 @@
 
 #define RUDDER_DEFL_DIST    200
 #define RUDDER_RET_SPEED    2.0f
+/* How often the rudder position is updated while it returns to neutral. */
+#define RUDDER_RET_INTERVAL 0.02f
 
 static XPLMCommandRef toggle_yoke_control;
-static XPLMDataRef yoke_pitch_ratio;
-static XPLMDataRef yoke_roll_ratio;
-static XPLMDataRef yoke_heading_ratio;
+/* Staged through dr_setf so unchanged values don't cost an SDK call. */
+static int yoke_pitch_ratio;
+static int yoke_roll_ratio;
+static int yoke_heading_ratio;
 static XPLMDataRef eq_pfc_yoke;
 static XPLMFlightLoopID loop_id;
 static int screen_width;
@@ -39,6 +43,24 @@ static int rudder_return;
 static int rudder_defl_dist;
 static float yaw_ratio;
 static float rudder_ret_spd;
+/* Frame time and deflection at which the rudder started returning. */
+static long long ret_start;
+static float ret_from;
+static int draw_registered;
+static resp_axis_t roll_axis;
+static resp_axis_t pitch_axis;
+static resp_axis_t yaw_axis;
+static long long last_frame;
+/* Use raw mouse motion instead of the cursor position. */
+static int raw_input;
+static float raw_sens;
+/* Virtual cursor driven by raw mouse motion. */
+static float raw_pos[2];
+/* profiler slots; their call counts and totals also show that the plugin
+   costs nothing while yoke control is off */
+static int prof_loop;
+static int prof_draw;
+static int prof_toggle;
 #ifdef IBM
 static HWND xp_hwnd;
 static HCURSOR yoke_cursor;
@@ -47,6 +69,17 @@ static HCURSOR arrow_cursor;
 static HCURSOR(WINAPI *true_set_cursor) (HCURSOR cursor) = SetCursor;
 #endif
 
+/* The draw callback only needs to run while there is something to draw. */
+static void set_draw_cb(int enable) {
+    if (enable == draw_registered)
+        return;
+    if (enable)
+        XPLMRegisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
+    else
+        XPLMUnregisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
+    draw_registered = enable;
+}
+
 /**
  * X-Plane 11 Plugin Entry Point.
  *
@@ -59,21 +92,21 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
+    path_init();
     toggle_yoke_control = XPLMCreateCommand("BetterMouseYoke/ToggleYokeControl",
         "Toggle mouse yoke control");
-    yoke_pitch_ratio = XPLMFindDataRef("sim/cockpit2/controls/yoke_pitch_ratio");
-    if (yoke_pitch_ratio == NULL) {
+    yoke_pitch_ratio = dr_stage("sim/cockpit2/controls/yoke_pitch_ratio");
+    if (yoke_pitch_ratio < 0) {
         _log("init fail: could not find yoke_pitch_ratio dataref");
         return 0;
     }
-    yoke_roll_ratio = XPLMFindDataRef("sim/cockpit2/controls/yoke_roll_ratio");
-    if (yoke_roll_ratio == NULL) {
+    yoke_roll_ratio = dr_stage("sim/cockpit2/controls/yoke_roll_ratio");
+    if (yoke_roll_ratio < 0) {
         _log("init fail: could not find yoke_roll_ratio dataref");
         return 0;
     }
-    yoke_heading_ratio = XPLMFindDataRef(
-        "sim/cockpit2/controls/yoke_heading_ratio");
-    if (yoke_heading_ratio == NULL) {
+    yoke_heading_ratio = dr_stage("sim/cockpit2/controls/yoke_heading_ratio");
+    if (yoke_heading_ratio < 0) {
         _log("init fail: could not find yoke_heading_ratio dataref");
         return 0;
     }
@@ -93,6 +126,14 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     }
     rudder_defl_dist = ini_geti("rudder_deflection_distance", RUDDER_DEFL_DIST);
     rudder_ret_spd = ini_getf("rudder_return_speed", RUDDER_RET_SPEED);
+    resp_init(&roll_axis, "roll");
+    resp_init(&pitch_axis, "pitch");
+    resp_init(&yaw_axis, "yaw");
+    raw_input = ini_geti("raw_input", 0);
+    raw_sens = ini_getf("raw_input_sensitivity", 1.0f);
+    prof_loop = prof_register("loop_cb");
+    prof_draw = prof_register("draw_cb");
+    prof_toggle = prof_register("toggle_yoke_control_cb");
 #ifdef IBM
     xp_hwnd = FindWindowA("X-System", "X-System");
     if (!xp_hwnd) {
@@ -133,6 +174,8 @@ PLUGIN_API void XPluginStop(void) {
         _log("could not unhook SetCursor function");
     }
 #endif
+    dr_clear();
+    log_deinit();
 }
 
 /**
@@ -142,9 +185,12 @@ PLUGIN_API void XPluginStop(void) {
  * started successfully, otherwise 0.
  */
 PLUGIN_API int XPluginEnable(void) {
+    /* Keep logging from the yoke loop off of the sim thread's frame time. */
+    log_async_init();
+    time_init();
+    prof_init();
     XPLMRegisterCommandHandler(toggle_yoke_control, toggle_yoke_control_cb,
         0, NULL);
-    XPLMRegisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
     XPLMCreateFlightLoop_t params = {
         .structSize = sizeof(XPLMCreateFlightLoop_t),
         .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
@@ -164,11 +210,16 @@ PLUGIN_API void XPluginDisable(void) {
     XPLMUnregisterCommandHandler(toggle_yoke_control, toggle_yoke_control_cb,
         0, NULL);
     XPLMSetDatai(eq_pfc_yoke, 0);
-    XPLMUnregisterDrawCallback(draw_cb, xplm_Phase_Window, 0, NULL);
+    set_draw_cb(0);
+    yoke_control_enabled = rudder_control = 0;
     if (loop_id)
         XPLMDestroyFlightLoop(loop_id);
     loop_id = NULL;
+    raw_deinit();
     menu_deinit();
+    prof_deinit();
+    time_deinit();
+    log_async_deinit();
 }
 
 /**
@@ -180,9 +231,10 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
     if (from != XPLM_PLUGIN_XPLANE)
         return;
     if (msg == XPLM_MSG_PLANE_LOADED) {
-        int index = (int)param;
+        int index = (int)(intptr_t)param;
         /* user's plane */
         if (index == XPLM_USER_AIRCRAFT) {
+            path_acft_changed();
             /* This will hide the clickable yoke control box. */
             XPLMSetDatai(eq_pfc_yoke, 1);
         }
@@ -204,9 +256,16 @@ int init_menu() {
 int toggle_yoke_control_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
     if (phase != xplm_CommandBegin)
         return 1;
+    long long t = prof_begin();
     if (yoke_control_enabled) {
         if (change_cursor)
             set_cursor_bmp(CURSOR_ARROW);
+        raw_deinit();
+        /* Let go of the rudder, the loop keeps running until it's back at
+           neutral. */
+        if (rudder_control)
+            start_rudder_return();
+        set_draw_cb(0);
         yoke_control_enabled = 0;
         rudder_control = 0;
     } else {
@@ -214,80 +273,131 @@ int toggle_yoke_control_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref
            give unrealiable results. Also the screen size may be changed by
            the user at any time. */
         XPLMGetScreenSize(&screen_width, &screen_height);
+        /* The yoke may have been moved by something else while we weren't
+           in control, so don't trust the values we last wrote. */
+        dr_invalidate();
+        /* Don't filter against where the yoke was when we last had it. */
+        resp_reset(&roll_axis, 0);
+        resp_reset(&pitch_axis, 0);
+        last_frame = 0;
+        /* Only capture raw motion while it's actually needed. If that's not
+           possible, stick to the cursor position for this session. */
+        if (raw_input && !raw_init())
+            raw_input = 0;
+        if (raw_input) {
+            int x, y;
+            get_cursor_pos(&x, &y);
+            raw_pos[0] = x;
+            raw_pos[1] = y;
+        }
         /* Set cursor position to align with current deflection of yoke. */
         if (set_pos)
             set_cursor_from_yoke();
         if (change_cursor)
             set_cursor_bmp(CURSOR_YOKE);
         yoke_control_enabled = 1;
+        set_draw_cb(1);
         XPLMScheduleFlightLoop(loop_id, -1.0f, 0);
     }
+    prof_end(prof_toggle, t);
     return 1;
 }
 
 int draw_cb(XPLMDrawingPhase phase, int before, void *ref) {
-    /* Show a little text indication in top left corner of screen. */
-    if (yoke_control_enabled) {
-        XPLMDrawString(magenta, 20, screen_height - 40, rudder_control ?
-            "MOUSE RUDDER CONTROL" : "MOUSE YOKE CONTROL",
-            NULL, xplmFont_Proportional);
-        if (rudder_control) {
-            /* Draw little bars to indicate maximum rudder deflection. */
-            for (int i = 1; i < 3; i++) {
-                XPLMDrawString(green, cursor_pos[0] - rudder_defl_dist,
-                    cursor_pos[1] + 4 - 7 * i, "|", NULL, xplmFont_Basic);
-                XPLMDrawString(green, cursor_pos[0] + rudder_defl_dist,
-                    cursor_pos[1] + 4 - 7 * i, "|", NULL, xplmFont_Basic);
-            }
+    long long t = prof_begin();
+    /* Show a little text indication in top left corner of screen. Only
+       registered while yoke control is enabled. */
+    XPLMDrawString(magenta, 20, screen_height - 40, rudder_control ?
+        "MOUSE RUDDER CONTROL" : "MOUSE YOKE CONTROL",
+        NULL, xplmFont_Proportional);
+    if (rudder_control) {
+        /* Draw little bars to indicate maximum rudder deflection. */
+        for (int i = 1; i < 3; i++) {
+            XPLMDrawString(green, cursor_pos[0] - rudder_defl_dist,
+                cursor_pos[1] + 4 - 7 * i, "|", NULL, xplmFont_Basic);
+            XPLMDrawString(green, cursor_pos[0] + rudder_defl_dist,
+                cursor_pos[1] + 4 - 7 * i, "|", NULL, xplmFont_Basic);
         }
     }
+    prof_end(prof_draw, t);
     return 1;
 }
 
+void start_rudder_return() {
+    ret_start = get_frame_time_ns();
+    ret_from = yaw_ratio;
+}
+
+/**
+ * Returns the rudder deflection at the specified time while the rudder is
+ * returning to neutral. This is computed from when the return started rather
+ * than stepped from frame to frame, so it comes out the same no matter how
+ * often it is called.
+ */
+static float rudder_return_pos(long long now) {
+    float d = fabsf(ret_from) - (now - ret_start) / 1e9f * rudder_ret_spd;
+    if (d <= 0)
+        return 0;
+    return ret_from > 0 ? d : -d;
+}
+
 float loop_cb(float last_call, float last_loop, int count, void *ref) {
-    static long long _last_time;
+    long long t = prof_begin();
+    long long now = get_frame_time_ns();
+    float next = -1.0f;
     /* If user has disabled mouse yoke control, suspend loop. */
     if (yoke_control_enabled == 0) {
         /* If rudder is still deflected, move it gradually back to zero. */
         if (yaw_ratio != 0 && rudder_return) {
-            long long now = get_time_ms();
-            float dt = (now - _last_time) / 1000.0f;
-            _last_time = now;
-            yaw_ratio = yaw_ratio > 0 ? max(0, yaw_ratio - dt * rudder_ret_spd) :
-                min(0, yaw_ratio + dt * rudder_ret_spd);
-            XPLMSetDataf(yoke_heading_ratio, yaw_ratio);
-            /* Call us again next frame until zero. */
-            return yaw_ratio ? -1.0f : 0;
+            yaw_ratio = rudder_return_pos(now);
+            dr_setf(yoke_heading_ratio, yaw_ratio);
+            /* Nothing else to do, so there's no need to run every frame.
+               Make sure to be called right when the rudder reaches zero
+               though. */
+            next = !yaw_ratio ? 0 : rudder_ret_spd <= 0 ? RUDDER_RET_INTERVAL :
+                min(RUDDER_RET_INTERVAL, fabsf(yaw_ratio) / rudder_ret_spd);
+        } else {
+            /* Don't call us anymore. */
+            next = 0;
         }
-        /* Don't call us anymore. */
-        return 0;
-    }
-    int m_x, m_y;
-    get_cursor_pos(&m_x, &m_y);
-    if (controlling_rudder(&m_x, &m_y)) {
-        int dist = min(max(m_x - cursor_pos[0], -rudder_defl_dist),
-            rudder_defl_dist);
-        _last_time = get_time_ms();
-        /* Save value so we don't have to continuously query the dr above. */
-        yaw_ratio = dist / (float)rudder_defl_dist;
-        XPLMSetDataf(yoke_heading_ratio, yaw_ratio);
     } else {
-        float yoke_roll = 2 * (m_x / (float)screen_width) - 1;
-        float yoke_pitch = 1 - 2 * (m_y / (float)screen_height);
-        XPLMSetDataf(yoke_roll_ratio, yoke_roll);
-        XPLMSetDataf(yoke_pitch_ratio, yoke_pitch);
-        /* If rudder is still deflected, move it gradually back to zero. */
-        if (yaw_ratio != 0 && rudder_return) {
-            long long now = get_time_ms();
-            float dt = (now - _last_time) / 1000.0f;
-            _last_time = now;
-            yaw_ratio = yaw_ratio > 0 ? max(0, yaw_ratio - dt * rudder_ret_spd) :
-                min(0, yaw_ratio + dt * rudder_ret_spd);
-            XPLMSetDataf(yoke_heading_ratio, yaw_ratio);
+        int m_x, m_y;
+        /* Filters need the real time between frames to behave the same at
+           any frame rate. */
+        float dt = last_frame ? (now - last_frame) / 1e9f : 0;
+        last_frame = now;
+        if (raw_input)
+            get_raw_cursor_pos(&m_x, &m_y);
+        else
+            get_cursor_pos(&m_x, &m_y);
+        if (controlling_rudder(&m_x, &m_y)) {
+            int dist = min(max(m_x - cursor_pos[0], -rudder_defl_dist),
+                rudder_defl_dist);
+            /* Save value so we don't have to continuously query the dr
+               above. */
+            yaw_ratio = resp_apply(&yaw_axis, dist / (float)rudder_defl_dist,
+                dt);
+            dr_setf(yoke_heading_ratio, yaw_ratio);
+        } else {
+            float yoke_roll = resp_apply(&roll_axis,
+                2 * (m_x / (float)screen_width) - 1, dt);
+            float yoke_pitch = resp_apply(&pitch_axis,
+                1 - 2 * (m_y / (float)screen_height), dt);
+            dr_setf(yoke_roll_ratio, yoke_roll);
+            dr_setf(yoke_pitch_ratio, yoke_pitch);
+            /* If rudder is still deflected, move it gradually back to
+               zero. */
+            if (yaw_ratio != 0 && rudder_return) {
+                yaw_ratio = rudder_return_pos(now);
+                dr_setf(yoke_heading_ratio, yaw_ratio);
+            }
         }
     }
-    /* Call us again next frame. */
-    return -1.0f;
+    /* Hand whatever has actually changed to X-Plane in one go. */
+    dr_flush();
+    prof_end(prof_loop, t);
+    /* Call us again next frame, unless told otherwise. */
+    return next;
 }
 
 int left_mouse_down() {
@@ -308,12 +418,18 @@ int controlling_rudder(int *x, int *y) {
             if (change_cursor)
                 set_cursor_bmp(CURSOR_RUDDER);
             /* Remember current cursor position. */
-            XPLMGetMouseLocationGlobal(cursor_pos, cursor_pos + 1);
+            if (raw_input) {
+                cursor_pos[0] = *x;
+                cursor_pos[1] = *y;
+            } else {
+                XPLMGetMouseLocationGlobal(cursor_pos, cursor_pos + 1);
+            }
             /* Set rudder cursor position, if enabled. */
             if (set_rudder_pos) {
-                *x = *x + yaw_ratio * rudder_defl_dist;
+                *x = *x + resp_invert(&yaw_axis, yaw_ratio) * rudder_defl_dist;
                 set_cursor_pos(*x, *y);
             }
+            resp_reset(&yaw_axis, 0);
             rudder_control = 1;
         }
     } else {
@@ -325,6 +441,7 @@ int controlling_rudder(int *x, int *y) {
             set_cursor_pos(cursor_pos[0], cursor_pos[1]);
             *x = cursor_pos[0];
             *y = cursor_pos[1];
+            start_rudder_return();
             rudder_control = 0;
         }
     }
@@ -346,14 +463,44 @@ void get_cursor_pos(int *x, int *y) {
 #endif
 }
 
+/**
+ * Moves the virtual cursor by the raw mouse motion since the last frame.
+ * Unlike the real cursor it is clamped to the range that actually deflects
+ * the controls, so reversing direction takes effect immediately and the
+ * edges of the screen don't get in the way.
+ */
+void get_raw_cursor_pos(int *x, int *y) {
+    int dx, dy;
+    float lo = 0, hi = screen_width;
+    raw_read(&dx, &dy);
+    if (rudder_control) {
+        lo = cursor_pos[0] - rudder_defl_dist;
+        hi = cursor_pos[0] + rudder_defl_dist;
+    }
+    raw_pos[0] = min(max(raw_pos[0] + dx * raw_sens, lo), hi);
+    raw_pos[1] = min(max(raw_pos[1] + dy * raw_sens, 0), screen_height);
+    *x = raw_pos[0];
+    *y = raw_pos[1];
+}
+
 void set_cursor_from_yoke() {
+    /* Undo the response curves so the cursor ends up where it would have
+       to be to produce the current deflection. */
     set_cursor_pos(
-        0.5 * screen_width  * (XPLMGetDataf(yoke_roll_ratio) + 1),
-        0.5 * screen_height * (1 - XPLMGetDataf(yoke_pitch_ratio))
+        0.5 * screen_width  * (resp_invert(&roll_axis,
+            dr_getf(yoke_roll_ratio)) + 1),
+        0.5 * screen_height * (1 - resp_invert(&pitch_axis,
+            dr_getf(yoke_pitch_ratio)))
     );
 }
 
 void set_cursor_pos(int x, int y) {
+    /* The real cursor has no bearing on the controls with raw input. */
+    if (raw_input) {
+        raw_pos[0] = x;
+        raw_pos[1] = y;
+        return;
+    }
 #ifdef IBM
     POINT pt = {
         .x = x,
@@ -23,6 +23,38 @@
 int hook_set_cursor(int attach);
 #endif
 
+#define RESP_LUT_SIZE 256
+
+typedef enum {
+    RESP_FILTER_NONE,
+    RESP_FILTER_ONE_EURO,
+    RESP_FILTER_DAMPED
+} resp_filter_t;
+
+typedef struct {
+    /* response curve for inputs in [0, 1] */
+    float lut[RESP_LUT_SIZE + 1];
+    resp_filter_t filter;
+    /* one-euro filter parameters */
+    float min_cutoff;
+    float beta;
+    /* critically damped filter parameters */
+    float smooth_time;
+    /* filter state */
+    float x;
+    float dx;
+    int primed;
+} resp_axis_t;
+
+void resp_init(resp_axis_t *a, const char *name);
+void resp_reset(resp_axis_t *a, float x);
+float resp_apply(resp_axis_t *a, float x, float dt);
+float resp_invert(const resp_axis_t *a, float y);
+
+int raw_init();
+void raw_deinit();
+void raw_read(int *dx, int *dy);
+
 typedef enum {
     CURSOR_ARROW,
     CURSOR_YOKE,
@@ -33,7 +65,9 @@ int init_menu();
 int toggle_yoke_control_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref);
 int draw_cb(XPLMDrawingPhase phase, int before, void *ref);
 float loop_cb(float last_call, float last_loop, int count, void *ref);
+void start_rudder_return();
 void get_cursor_pos(int *x, int *y);
+void get_raw_cursor_pos(int *x, int *y);
 void set_cursor_from_yoke();
 void set_cursor_pos(int x, int y);
 void set_cursor_bmp(cursor_t cursor);
@@ -0,0 +1,363 @@
+/**
+ * BetterMouseYoke - X-Plane 11 Plugin
+ *
+ * Does away with X-Plane's idiotic centered little box for mouse steering and
+ * replaces it with a more sane system for those who, for whatever reason,
+ * want to or have to use the mouse for flying.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+#include <stdlib.h>
+#ifdef IBM
+#include <commctrl.h>
+#pragma comment(lib, "comctl32.lib")
+#elif APL
+#include <IOKit/hid/IOHIDManager.h>
+#endif
+
+/**
+ * Relative mouse motion is captured at whatever rate the device reports it
+ * on a dedicated thread (Raw Input on Windows, IOHID on macOS) and summed up
+ * into running totals. The flight loop reads the totals once per frame and
+ * takes the difference to the previous read, so the capture thread never
+ * has to wait on the sim thread or vice versa. Totals are unsigned so they
+ * can wrap around safely.
+ *
+ * The capture thread mustn't call into XPLM or _log, so anything that can
+ * fail is set up and reported from raw_init on the sim thread.
+ *
+ * On Windows there can only be one Raw Input registration per device type
+ * and process. If X-Plane has registered for raw mouse input itself, its
+ * registration is left alone and its window is subclassed instead, so
+ * both get to read the same WM_INPUT messages.
+ */
+static struct {
+    volatile unsigned int x;
+    volatile unsigned int y;
+    /* totals as of the last raw_read */
+    unsigned int last_x;
+    unsigned int last_y;
+    volatile int quit;
+    int active;
+    thread_t thread;
+#ifdef IBM
+    HINSTANCE inst;
+    HANDLE quit_event;
+    HANDLE ready_event;
+    volatile int failed;
+    /* X-Plane's window if it is the one registered for raw input */
+    HWND host_hwnd;
+#elif APL
+    IOHIDManagerRef hid;
+#endif
+} raw;
+
+/* Positive dy is up, as with X-Plane's screen coordinates. */
+static void raw_add(int dx, int dy) {
+    if (dx)
+        atomic_add_int(&raw.x, dx);
+    if (dy)
+        atomic_add_int(&raw.y, dy);
+}
+
+#ifdef IBM
+#define RAW_WND_CLASS   "BetterMouseYokeRawInput"
+#define RAW_SUBCLASS_ID 0x52415749 /* RAWI */
+
+/* Reading the input doesn't consume it, so it's still there for X-Plane. */
+static void raw_handle_input(HRAWINPUT handle) {
+    RAWINPUT ri;
+    UINT size = sizeof(ri);
+    if (GetRawInputData(handle, RID_INPUT, &ri, &size,
+        sizeof(RAWINPUTHEADER)) != (UINT)-1 &&
+        ri.header.dwType == RIM_TYPEMOUSE &&
+        !(ri.data.mouse.usFlags & MOUSE_MOVE_ABSOLUTE)) {
+        /* On Windows positive y is down. */
+        raw_add(ri.data.mouse.lLastX, -ri.data.mouse.lLastY);
+    }
+}
+
+static LRESULT CALLBACK raw_wnd_proc(HWND hwnd, UINT msg, WPARAM wp,
+    LPARAM lp) {
+    if (msg == WM_INPUT)
+        raw_handle_input((HRAWINPUT)lp);
+    /* Must be called for WM_INPUT as well so the system can clean up. */
+    return DefWindowProcA(hwnd, msg, wp, lp);
+}
+
+static LRESULT CALLBACK raw_subclass_proc(HWND hwnd, UINT msg, WPARAM wp,
+    LPARAM lp, UINT_PTR id, DWORD_PTR ref) {
+    if (msg == WM_INPUT)
+        raw_handle_input((HRAWINPUT)lp);
+    return DefSubclassProc(hwnd, msg, wp, lp);
+}
+
+/**
+ * Looks up the process' Raw Input registration for the mouse. Returns 1 and
+ * its target window, which is NULL if input goes to the focus window, if
+ * there is one, 0 if there's none and -1 on error.
+ */
+static int raw_find_mouse(HWND *target) {
+    UINT num = 0;
+    if (GetRegisteredRawInputDevices(NULL, &num, sizeof(RAWINPUTDEVICE)) ==
+        (UINT)-1) {
+        return -1;
+    }
+    if (!num)
+        return 0;
+    RAWINPUTDEVICE *devs = malloc(num * sizeof(RAWINPUTDEVICE));
+    if (!devs)
+        return -1;
+    int found = 0;
+    UINT n = GetRegisteredRawInputDevices(devs, &num, sizeof(RAWINPUTDEVICE));
+    if (n == (UINT)-1)
+        found = -1;
+    for (UINT i = 0; found == 0 && i < n; i++) {
+        if (devs[i].usUsagePage == 0x01 && devs[i].usUsage == 0x02) {
+            *target = devs[i].hwndTarget;
+            found = 1;
+        }
+    }
+    free(devs);
+    return found;
+}
+
+static void raw_thread_func(void *arg) {
+    /* WM_INPUT is only delivered to windows, a message-only one will do. */
+    HWND hwnd = CreateWindowExA(0, RAW_WND_CLASS, NULL, 0, 0, 0, 0, 0,
+        HWND_MESSAGE, NULL, raw.inst, NULL);
+    RAWINPUTDEVICE rid = {
+        .usUsagePage = 0x01,    /* generic desktop */
+        .usUsage = 0x02,        /* mouse */
+        /* Receive input even while X-Plane's window is in the foreground. */
+        .dwFlags = RIDEV_INPUTSINK,
+        .hwndTarget = hwnd
+    };
+    if (!hwnd || !RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
+        raw.failed = GetLastError();
+        if (hwnd)
+            DestroyWindow(hwnd);
+        SetEvent(raw.ready_event);
+        return;
+    }
+    SetEvent(raw.ready_event);
+    for (;;) {
+        DWORD ret = MsgWaitForMultipleObjects(1, &raw.quit_event, FALSE,
+            INFINITE, QS_ALLINPUT);
+        if (ret != WAIT_OBJECT_0 + 1)
+            break;
+        MSG msg;
+        while (PeekMessageA(&msg, NULL, 0, 0, PM_REMOVE))
+            DispatchMessageA(&msg);
+    }
+    /* Only remove the registration if it's still ours. If X-Plane has
+       registered since, it has replaced ours and must be left alone. */
+    HWND target;
+    if (raw_find_mouse(&target) > 0 && target == hwnd) {
+        rid.dwFlags = RIDEV_REMOVE;
+        rid.hwndTarget = NULL;
+        RegisterRawInputDevices(&rid, 1, sizeof(rid));
+    }
+    DestroyWindow(hwnd);
+}
+
+static int raw_open() {
+    /* The window class belongs to this DLL, not to X-Plane's executable. */
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+        GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)raw_wnd_proc,
+        &raw.inst)) {
+        _log("raw_init: could not get module handle (%i)", GetLastError());
+        return 0;
+    }
+    HWND target = NULL;
+    int found = raw_find_mouse(&target);
+    if (found < 0) {
+        _log("raw_init: could not get raw input devices (%i)",
+            GetLastError());
+        return 0;
+    }
+    if (found) {
+        /* Registering would take raw input away from X-Plane, so read it
+           off X-Plane's window instead. That means no input while X-Plane
+           is in the background, which doesn't matter for flying. */
+        if (!target)
+            target = FindWindowA("X-System", "X-System");
+        if (!target || !SetWindowSubclass(target, raw_subclass_proc,
+            RAW_SUBCLASS_ID, 0)) {
+            _log("raw_init: could not subclass X-Plane window (%i)",
+                GetLastError());
+            return 0;
+        }
+        raw.host_hwnd = target;
+        log_info("raw_init: sharing X-Plane's raw input registration");
+        return 1;
+    }
+    WNDCLASSA wc = {
+        .lpfnWndProc = raw_wnd_proc,
+        .hInstance = raw.inst,
+        .lpszClassName = RAW_WND_CLASS
+    };
+    if (!RegisterClassA(&wc)) {
+        _log("raw_init: could not register window class (%i)",
+            GetLastError());
+        return 0;
+    }
+    raw.quit_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    raw.ready_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!raw.quit_event || !raw.ready_event) {
+        _log("raw_init: could not create events (%i)", GetLastError());
+        return 0;
+    }
+    raw.failed = 0;
+    if (!(raw.thread = thread_create(raw_thread_func, NULL)))
+        return 0;
+    WaitForSingleObject(raw.ready_event, INFINITE);
+    if (raw.failed) {
+        _log("raw_init: could not register for raw input (%i)", raw.failed);
+        return 0;
+    }
+    return 1;
+}
+
+static void raw_close() {
+    if (raw.host_hwnd) {
+        RemoveWindowSubclass(raw.host_hwnd, raw_subclass_proc,
+            RAW_SUBCLASS_ID);
+        raw.host_hwnd = NULL;
+    }
+    if (raw.thread) {
+        SetEvent(raw.quit_event);
+        thread_join(raw.thread);
+        raw.thread = NULL;
+    }
+    if (raw.quit_event)
+        CloseHandle(raw.quit_event);
+    if (raw.ready_event)
+        CloseHandle(raw.ready_event);
+    raw.quit_event = raw.ready_event = NULL;
+    if (raw.inst)
+        UnregisterClassA(RAW_WND_CLASS, raw.inst);
+    raw.inst = NULL;
+}
+#elif APL
+static void raw_hid_cb(void *ctx, IOReturn res, void *sender,
+    IOHIDValueRef val) {
+    IOHIDElementRef el = IOHIDValueGetElement(val);
+    if (IOHIDElementGetUsagePage(el) != kHIDPage_GenericDesktop ||
+        !IOHIDElementIsRelative(el)) {
+        return;
+    }
+    int v = (int)IOHIDValueGetIntegerValue(val);
+    switch (IOHIDElementGetUsage(el)) {
+    case kHIDUsage_GD_X:
+        raw_add(v, 0);
+        break;
+    case kHIDUsage_GD_Y:
+        /* HID reports positive y as down. */
+        raw_add(0, -v);
+        break;
+    }
+}
+
+static void raw_thread_func(void *arg) {
+    CFRunLoopRef rl = CFRunLoopGetCurrent();
+    IOHIDManagerScheduleWithRunLoop(raw.hid, rl, kCFRunLoopDefaultMode);
+    /* Run in short slices rather than relying on CFRunLoopStop, which is
+       lost if it's called before the run loop has been entered. */
+    while (!atomic_load_int(&raw.quit)) {
+        if (CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false) ==
+            kCFRunLoopRunFinished) {
+            break;
+        }
+    }
+    IOHIDManagerUnscheduleFromRunLoop(raw.hid, rl, kCFRunLoopDefaultMode);
+}
+
+static int raw_open() {
+    int page = kHIDPage_GenericDesktop, usage = kHIDUsage_GD_Mouse;
+    if (!(raw.hid = IOHIDManagerCreate(kCFAllocatorDefault,
+        kIOHIDOptionsTypeNone))) {
+        _log("raw_init: could not create HID manager");
+        return 0;
+    }
+    const void *keys[] = {
+        CFSTR(kIOHIDDeviceUsagePageKey), CFSTR(kIOHIDDeviceUsageKey)
+    };
+    const void *vals[] = {
+        CFNumberCreate(NULL, kCFNumberIntType, &page),
+        CFNumberCreate(NULL, kCFNumberIntType, &usage)
+    };
+    CFDictionaryRef match = CFDictionaryCreate(NULL, keys, vals, 2,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    IOHIDManagerSetDeviceMatching(raw.hid, match);
+    CFRelease(match);
+    CFRelease(vals[0]);
+    CFRelease(vals[1]);
+    IOHIDManagerRegisterInputValueCallback(raw.hid, raw_hid_cb, NULL);
+    IOReturn ret = IOHIDManagerOpen(raw.hid, kIOHIDOptionsTypeNone);
+    if (ret != kIOReturnSuccess) {
+        /* Most likely X-Plane hasn't been granted Input Monitoring. */
+        _log("raw_init: could not open HID manager (%i)", ret);
+        return 0;
+    }
+    if (!(raw.thread = thread_create(raw_thread_func, NULL)))
+        return 0;
+    return 1;
+}
+
+static void raw_close() {
+    if (raw.thread) {
+        atomic_store_int(&raw.quit, 1);
+        thread_join(raw.thread);
+        raw.thread = NULL;
+    }
+    if (raw.hid) {
+        IOHIDManagerClose(raw.hid, kIOHIDOptionsTypeNone);
+        CFRelease(raw.hid);
+    }
+    raw.hid = NULL;
+}
+#else
+static int raw_open() {
+    _log("raw_init: raw input is not supported on this platform");
+    return 0;
+}
+
+static void raw_close() {
+}
+#endif
+
+/**
+ * Starts capturing relative mouse motion. Returns 0 if capturing is not
+ * possible, in which case the cursor position must be used instead.
+ */
+int raw_init() {
+    if (raw.active)
+        return 1;
+    raw.x = raw.y = raw.last_x = raw.last_y = 0;
+    raw.quit = 0;
+    if (!raw_open()) {
+        raw_close();
+        return 0;
+    }
+    raw.active = 1;
+    return 1;
+}
+
+void raw_deinit() {
+    raw_close();
+    raw.active = 0;
+}
+
+/**
+ * Gets the mouse motion in device units accumulated since the last call.
+ */
+void raw_read(int *dx, int *dy) {
+    unsigned int x = atomic_load_int(&raw.x);
+    unsigned int y = atomic_load_int(&raw.y);
+    *dx = (int)(x - raw.last_x);
+    *dy = (int)(y - raw.last_y);
+    raw.last_x = x;
+    raw.last_y = y;
+}
@@ -0,0 +1,156 @@
+/**
+ * BetterMouseYoke - X-Plane 11 Plugin
+ *
+ * Does away with X-Plane's idiotic centered little box for mouse steering and
+ * replaces it with a more sane system for those who, for whatever reason,
+ * want to or have to use the mouse for flying.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+#include <math.h>
+
+#define PI 3.14159265f
+
+/**
+ * Each control axis runs its input, a ratio in the range [-1, 1], through a
+ * small pipeline: an optional smoothing filter followed by a response curve
+ * made up of a deadzone and expo shaping. The curve is sampled into a lookup
+ * table whenever the settings are (re-)read, so applying it costs a table
+ * lookup and a lerp per frame. Filters are driven by the real time elapsed
+ * between frames, so they behave the same at 30 and at 144 fps.
+ *
+ * The settings for an axis are read from settings.ini using the axis name
+ * as prefix, e.g. roll_deadzone, roll_expo, roll_filter.
+ */
+static float shape(float x, float deadzone, float expo) {
+    if (x <= deadzone)
+        return 0;
+    x = (x - deadzone) / (1 - deadzone);
+    /* Blend of linear and cubic, flat around center and steep at the ends. */
+    return (1 - expo) * x + expo * x * x * x;
+}
+
+void resp_init(resp_axis_t *a, const char *name) {
+    char key[64], buf[32];
+    memset(a, 0, sizeof(*a));
+    snprintf(key, sizeof(key), "%s_deadzone", name);
+    float deadzone = min(max(ini_getf(key, 0), 0.0f), 0.9f);
+    snprintf(key, sizeof(key), "%s_expo", name);
+    float expo = min(max(ini_getf(key, 0), 0.0f), 1.0f);
+    for (int i = 0; i <= RESP_LUT_SIZE; i++)
+        a->lut[i] = shape(i / (float)RESP_LUT_SIZE, deadzone, expo);
+    snprintf(key, sizeof(key), "%s_filter", name);
+    ini_gets(key, buf, sizeof(buf), "none");
+    if (!_stricmp(buf, "one_euro"))
+        a->filter = RESP_FILTER_ONE_EURO;
+    else if (!_stricmp(buf, "damped"))
+        a->filter = RESP_FILTER_DAMPED;
+    else
+        a->filter = RESP_FILTER_NONE;
+    snprintf(key, sizeof(key), "%s_min_cutoff", name);
+    a->min_cutoff = max(ini_getf(key, 1.0f), 0.01f);
+    snprintf(key, sizeof(key), "%s_beta", name);
+    a->beta = max(ini_getf(key, 0.5f), 0.0f);
+    snprintf(key, sizeof(key), "%s_smooth_time", name);
+    a->smooth_time = max(ini_getf(key, 0.05f), 0.001f);
+    log_debug("%s: deadzone = %.2f | expo = %.2f | filter = %s", name,
+        deadzone, expo, buf);
+}
+
+/* Starts filtering over from the specified value. */
+void resp_reset(resp_axis_t *a, float x) {
+    a->x = x;
+    a->dx = 0;
+    a->primed = 0;
+}
+
+static float curve(const resp_axis_t *a, float x) {
+    float s = fabsf(x) * RESP_LUT_SIZE;
+    if (s >= RESP_LUT_SIZE)
+        return x < 0 ? -a->lut[RESP_LUT_SIZE] : a->lut[RESP_LUT_SIZE];
+    int i = (int)s;
+    float y = a->lut[i] + (s - i) * (a->lut[i + 1] - a->lut[i]);
+    return x < 0 ? -y : y;
+}
+
+/* Smoothing factor of a first-order low-pass filter. */
+static float lp_alpha(float cutoff, float dt) {
+    float tau = 1 / (2 * PI * cutoff);
+    return dt / (dt + tau);
+}
+
+/**
+ * One-euro filter (Casiez et al.), a low-pass filter whose cutoff frequency
+ * rises with the speed of the input: slow movements are smoothed a lot,
+ * fast ones hardly lag.
+ */
+static float one_euro(resp_axis_t *a, float x, float dt) {
+    float dx = (x - a->x) / dt;
+    a->dx += lp_alpha(1.0f, dt) * (dx - a->dx);
+    float cutoff = a->min_cutoff + a->beta * fabsf(a->dx);
+    a->x += lp_alpha(cutoff, dt) * (x - a->x);
+    return a->x;
+}
+
+/**
+ * Critically damped spring that follows the input without overshooting,
+ * reaching it in roughly smooth_time seconds.
+ */
+static float damped(resp_axis_t *a, float x, float dt) {
+    float omega = 2 / a->smooth_time;
+    float k = omega * dt;
+    /* Approximation of exp(-k) that's good enough for this purpose. */
+    float e = 1 / (1 + k + 0.48f * k * k + 0.235f * k * k * k);
+    float change = a->x - x;
+    float temp = (a->dx + omega * change) * dt;
+    a->dx = (a->dx - omega * temp) * e;
+    a->x = x + (change + temp) * e;
+    return a->x;
+}
+
+/**
+ * Runs the input through the axis' filter and response curve. dt is the
+ * time since the last call in seconds.
+ */
+float resp_apply(resp_axis_t *a, float x, float dt) {
+    if (a->filter != RESP_FILTER_NONE) {
+        if (!a->primed || dt <= 0) {
+            /* Nothing to filter against yet. */
+            a->primed = 1;
+            a->x = x;
+            a->dx = 0;
+        } else if (a->filter == RESP_FILTER_ONE_EURO) {
+            x = one_euro(a, x, dt);
+        } else {
+            x = damped(a, x, dt);
+        }
+    }
+    return curve(a, x);
+}
+
+/**
+ * Returns the smallest input that the response curve maps to the specified
+ * output, e.g. for placing the cursor to match the current yoke deflection.
+ * For no deflection at all that's the center, not the edge of the deadzone.
+ */
+float resp_invert(const resp_axis_t *a, float y) {
+    float t = fabsf(y);
+    int lo = -1, hi = RESP_LUT_SIZE;
+    if (t >= a->lut[hi])
+        return y < 0 ? -1.0f : 1.0f;
+    /* The curve is monotonic, so a binary search for the first entry that
+       is >= t will do. */
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (a->lut[mid] >= t)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    if (!hi)
+        return 0;
+    float d = a->lut[hi] - a->lut[lo];
+    float x = (lo + (d > 0 ? (t - a->lut[lo]) / d : 0)) / RESP_LUT_SIZE;
+    return y < 0 ? -x : x;
+}
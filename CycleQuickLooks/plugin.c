@@ -21,6 +21,8 @@ static XPLMCommandRef cycle_backward;
 static int quick_looks[MAX_QUICK_LOOKS];
 static int num_quick_looks;
 static int current;
+/* profiler slot */
+static int prof_cycle;
 
 int cycle_quick_look_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref);
 int get_quick_looks(int *buf, int buf_size);
@@ -37,9 +39,11 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
+    path_init();
 #ifdef APL
     XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
 #endif
+    prof_cycle = prof_register("cycle_quick_look_cb");
     return 1;
 }
 
@@ -49,7 +53,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
  * Called when the plugin is about to be unloaded from X-Plane 11.
  */
 PLUGIN_API void XPluginStop(void) {
-    /* nothing to do here */
+    log_deinit();
 }
 
 /**
@@ -59,6 +63,7 @@ PLUGIN_API void XPluginStop(void) {
  * started successfully, otherwise 0.
  */
 PLUGIN_API int XPluginEnable(void) {
+    prof_init();
     cycle_forward = cmd_create("CycleQuickLooks/Forward",
         "Cycle forward to next quick look", cycle_quick_look_cb, 0);
     cycle_backward = cmd_create("CycleQuickLooks/Backward",
@@ -74,6 +79,7 @@ PLUGIN_API int XPluginEnable(void) {
 PLUGIN_API void XPluginDisable(void) {
     cmd_free(cycle_forward, cycle_quick_look_cb, 0);
     cmd_free(cycle_backward, cycle_quick_look_cb, (void*)1);
+    prof_deinit();
 }
 
 /**
@@ -88,6 +94,7 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
         int index = (int) param;
         /* user's plane */
         if (index == XPLM_USER_AIRCRAFT) {
+            path_acft_changed();
             /* We cannot call this from XPluginEnable because at that point
                XPLMGetNthAircraftModel won't return any paths yet...*/
             num_quick_looks = get_quick_looks(quick_looks, MAX_QUICK_LOOKS);
@@ -101,8 +108,9 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
  * the number of quick-looks found.
  */
 int get_quick_looks(int *buf, int buf_size) {
-    char name[256], path[512];
-    XPLMGetNthAircraftModel(0, name, path);
+    char path[PATH_BUF + 16];
+    const path_t *acf = path_acft_file();
+    memcpy(path, acf->str, acf->len + 1);
     /* Overwrite .acf extension to get path for _prefs file. */
     char *p = strrchr(path, '.');
     if (!p) {
@@ -133,6 +141,7 @@ int get_quick_looks(int *buf, int buf_size) {
 int cycle_quick_look_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
     if (phase != xplm_CommandBegin || !num_quick_looks)
         return 1;
+    long long t = prof_begin();
     if (ref) {
         /* cycle backward */
         if (--current < 0)
@@ -145,9 +154,10 @@ int cycle_quick_look_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *ref) {
     char buf[128];
     snprintf(buf, sizeof(buf), "sim/view/quick_look_%i",
         quick_looks[current]);
-    _debug("exec '%s'", buf);
+    log_debug("exec '%s'", buf);
     XPLMCommandRef cmd_ref = XPLMFindCommand(buf);
     if (cmd_ref)
         XPLMCommandOnce(cmd_ref);
+    prof_end(prof_cycle, t);
     return 1;
 }
@@ -7,17 +7,69 @@
  * Copyright 2019 Torben Knke.
  */
 #include "plugin.h"
+#include "../XP/XPLMProcessing.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
+/**
+ * A binding as read from the .prf file. For unknown button identifiers
+ * mbutton is M_NONE and name holds the identifier.
+ */
 typedef struct {
     mbutton_t mbutton;
+    mgesture_t gesture;
     int mod;
-    XPLMCommandRef cmd;
+    int seq_len;
+    mbutton_t seq[M_MAX_SEQ];
+    /* dataref increment, 0 for command bindings */
+    float step;
+    char name[128];
 } mbinding_t;
 
-#define MAX_NUM_BINDINGS 64
+typedef struct {
+    mbinding_t *items;
+    int num;
+    int cap;
+    /* timing windows, in milliseconds */
+    int double_time;
+    int long_time;
+    int seq_time;
+    int wheel_detent;
+    float wheel_accel;
+    /* whether the list was read from the cache, and how long that took */
+    int cached;
+    long long load_us;
+} mbinding_list_t;
+
+#define DEF_DOUBLE_TIME  300
+#define DEF_LONG_TIME    500
+#define DEF_SEQ_TIME     800
+#define DEF_WHEEL_DETENT M_WHEEL_DELTA
+#define DEF_WHEEL_ACCEL  1.0f
 
-static mbinding_t bindings[MAX_NUM_BINDINGS];
-static int num_bindings;
+/**
+ * The .prf file is watched for changes while the aircraft is loaded. A
+ * changed file is parsed on a separate thread, after which the sim thread
+ * resolves the commands (XPLM may only be called from the sim thread) into
+ * a new table and publishes it with a single pointer swap. The event hooks
+ * therefore always see either the old or the new table, never a partially
+ * built one, and never have to take a lock. Readers on other threads
+ * (the evdev reader on Linux) hold on to a table from bindings_acquire to
+ * bindings_release, which spans a single event; the replaced table is only
+ * freed once no reader is left that may still be using it.
+ */
+static mbinding_tbl_t *bindings;
+static volatile int readers;
+static char prf_path[PATH_BUF];
+static long long prf_mtime;
+static long long prf_size;
+static XPLMFlightLoopID watch_loop_id;
+static thread_t parse_thread;
+static mbinding_list_t *parse_result;
+static volatile int parse_done;
+
+#define WATCH_INTERVAL 2.0f /* seconds */
 
 typedef struct {
     mbutton_t button;
@@ -62,21 +114,76 @@ static flag_map_t flags[] = {
 };
 static int num_flags = sizeof(flags) / sizeof(flags[0]);
 
+/* Doesn't use strtok since this also runs on the parse thread. */
 static int parse_modifiers(char *s) {
     int n = 0;
-    char *p = strtok(s, "+");
-    while (p) {
+    while (*s) {
+        char *p = strchr(s, '+');
+        if (p)
+            *p = '\0';
         for (int i = 0; i < num_flags; i++) {
-            if (!strcmp(p, flags[i].name)) {
+            if (!strcmp(s, flags[i].name)) {
                 n |= flags[i].flag;
                 break;
             }
         }
-        p = strtok(NULL, "+");
+        if (!p)
+            break;
+        s = p + 1;
     }
     return n;
 }
 
+static int is_wheel(mbutton_t mbutton) {
+    return mbutton >= M_W_FORWARD && mbutton <= M_W_RIGHT;
+}
+
+/**
+ * Parses a button identifier with an optional gesture suffix, as in
+ * Mouse-Forward:Double or Mouse-Middle:Long, or a sequence of button
+ * identifiers separated by commas, as in Mouse-Forward,Mouse-Backward.
+ */
+static int parse_gesture(char *s, mbinding_t *pb) {
+    pb->gesture = M_GESTURE_PRESS;
+    pb->seq_len = 0;
+    char *p = strchr(s, ':');
+    if (p) {
+        *p++ = '\0';
+        if (!_stricmp(p, "Double"))
+            pb->gesture = M_GESTURE_DOUBLE;
+        else if (!_stricmp(p, "Long"))
+            pb->gesture = M_GESTURE_LONG;
+        else
+            return 0;
+    }
+    while (s) {
+        p = strchr(s, ',');
+        if (p)
+            *p++ = '\0';
+        mbutton_t mbutton = parse_mbutton(s);
+        if (!mbutton || pb->seq_len == M_MAX_SEQ)
+            return 0;
+        pb->seq[pb->seq_len++] = mbutton;
+        s = p;
+    }
+    if (pb->seq_len > 1) {
+        if (pb->gesture != M_GESTURE_PRESS)
+            return 0;
+        pb->gesture = M_GESTURE_SEQ;
+    } else if (pb->gesture == M_GESTURE_DOUBLE) {
+        pb->seq[pb->seq_len++] = pb->seq[0];
+    }
+    pb->mbutton = pb->seq[pb->seq_len - 1];
+    /* Wheel ticks have no duration and don't take part in sequences. */
+    if (pb->gesture != M_GESTURE_PRESS) {
+        for (int i = 0; i < pb->seq_len; i++) {
+            if (is_wheel(pb->seq[i]))
+                return 0;
+        }
+    }
+    return 1;
+}
+
 static char *read_token(char *p, char *buf, int size) {
     /* Skip whitespaces, if any. */
     while (*p == ' ' || *p == '\t')
@@ -90,54 +197,525 @@ static char *read_token(char *p, char *buf, int size) {
     return p;
 }
 
-int bindings_init() {
-    /* Look for a mouse.prf for the aircraft we're flying first. */
-    char name[256], path[512], buf[512];
-    XPLMGetNthAircraftModel(0, name, buf);
-    get_plugin_dir(path, sizeof(path));
-    char *p = strrchr(name, '.');
-    if (p)
-        strcpy(p + 1, "prf");
-    sprintf(buf, "%s/%s", path, name);
-    FILE *fp = fopen(buf, "r");
-    if (!fp) {
-        /* Otherwise probe for mouse.prf in plugin directory. */
-        _log("could not load mouse bindings for aircraft from '%s'", path);
-        sprintf(path, "%s/mouse.prf", path);
-        if (!(fp = fopen(path, "r"))) {
-            _log("could not load mouse bindings from '%s'", path);
-            return 0;
-        }
+static unsigned int fnv1a(const void *data, size_t len) {
+    const unsigned char *p = data;
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
     }
-    num_bindings = 0;
-    char line[128], token[64];
-    while (fgets(line, sizeof(line), fp)) {
-        if (!strcmp("I\n", line) || !strcmp("1005 Version\n", line))
-            continue;
+    return h;
+}
+
+static mbinding_list_t *parse_buf(char *buf) {
+    mbinding_list_t *list = calloc(1, sizeof(mbinding_list_t));
+    if (!list)
+        return NULL;
+    list->double_time = DEF_DOUBLE_TIME;
+    list->long_time = DEF_LONG_TIME;
+    list->seq_time = DEF_SEQ_TIME;
+    list->wheel_detent = DEF_WHEEL_DETENT;
+    list->wheel_accel = DEF_WHEEL_ACCEL;
+    char token[128];
+    char *line = buf;
+    while (line) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
         char *p = read_token(line, token, sizeof(token));
-        if (token[0] == '#')
+        line = next;
+        if (token[0] == '#' || !token[0] || !strcmp(token, "I"))
             continue;
-        mbinding_t *pb = &bindings[num_bindings];
-        if (!(pb->mbutton = parse_mbutton(token))) {
-            _log("unknown mouse button identifier: %s", token);
+        if (!strcmp(token, "1005"))
+            continue;
+        /* Timing windows for gestures, in milliseconds. */
+        int *time = !_stricmp(token, "Double-Click-Time") ?
+            &list->double_time : !_stricmp(token, "Long-Press-Time") ?
+            &list->long_time : !_stricmp(token, "Sequence-Time") ?
+            &list->seq_time : !_stricmp(token, "Wheel-Detent") ?
+            &list->wheel_detent : NULL;
+        if (time) {
+            read_token(p, token, sizeof(token));
+            if (atoi(token) > 0)
+                *time = atoi(token);
+            continue;
+        }
+        if (!_stricmp(token, "Wheel-Acceleration")) {
+            read_token(p, token, sizeof(token));
+            list->wheel_accel = max((float)atof(token), 0.0f);
+            continue;
+        }
+        if (list->num == list->cap) {
+            int cap = list->cap ? list->cap * 2 : 16;
+            mbinding_t *items = realloc(list->items, cap * sizeof(mbinding_t));
+            if (!items)
+                break;
+            list->items = items;
+            list->cap = cap;
+        }
+        mbinding_t *pb = &list->items[list->num++];
+        memset(pb, 0, sizeof(mbinding_t));
+        strcpy(pb->name, token);
+        if (!parse_gesture(token, pb)) {
+            pb->mbutton = M_NONE;
+            pb->mod = 0;
             continue;
         }
         p = read_token(p, token, sizeof(token));
         pb->mod = parse_modifiers(token);
-        p = read_token(p, token, sizeof(token));
-        pb->cmd = XPLMFindCommand(token);
-        num_bindings++;
-        _debug("binding  mbutton = %i | mod = %x | cmd = %s",
-            pb->mbutton, pb->mod, token);
+        p = read_token(p, pb->name, sizeof(pb->name));
+        /* A fourth column makes this a dataref increment binding. */
+        read_token(p, token, sizeof(token));
+        pb->step = token[0] ? (float)atof(token) : 0;
+    }
+    return list;
+}
+
+/**
+ * Parsed bindings are cached in a binary file next to the .prf file, so
+ * that the .prf file needn't be parsed again every time the aircraft is
+ * loaded. If the .prf file's modification time and size still match the
+ * ones the cache was created from, the cache is used without reading the
+ * .prf file at all; that's the same test the file watcher uses. Only if
+ * they don't is the .prf file read and hashed, so that a file that was
+ * merely touched can still be loaded from the cache. The records
+ * are written as-is, so the cache is only valid for the same build of the
+ * plugin, which the version and record size guard against.
+ */
+#define CACHE_MAGIC     0x3143424d /* MBC1 */
+#define CACHE_VERSION   1
+#define CACHE_EXT       ".cache"
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int rec_size;
+    unsigned int hash;
+    long long mtime;
+    long long size;
+    int num;
+    int double_time;
+    int long_time;
+    int seq_time;
+    int wheel_detent;
+    float wheel_accel;
+} cache_hdr_t;
+
+/* Opens the cache and reads its header. Returns NULL if there's no cache or
+   it was written by a different build of the plugin. */
+static FILE *open_cache(const char *path, cache_hdr_t *hdr) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    if (fread(hdr, sizeof(*hdr), 1, fp) != 1 || hdr->magic != CACHE_MAGIC ||
+        hdr->version != CACHE_VERSION || hdr->rec_size != sizeof(mbinding_t) ||
+        hdr->num < 0 || hdr->double_time <= 0 || hdr->long_time <= 0 ||
+        hdr->seq_time <= 0 || hdr->wheel_detent <= 0 ||
+        !(hdr->wheel_accel >= 0)) {
+        fclose(fp);
+        return NULL;
     }
+    return fp;
+}
+
+/**
+ * Checks a binding read from the cache before its fields get used as
+ * indices into the bindings table. The cache may be truncated, stale or
+ * edited by hand, so none of it can be trusted.
+ */
+static int valid_binding(const mbinding_t *pb) {
+    if ((unsigned int)pb->mbutton >= M_NUM_BUTTONS ||
+        (unsigned int)pb->mod >= M_NUM_MODS ||
+        (unsigned int)pb->gesture > M_GESTURE_SEQ ||
+        pb->seq_len < 0 || pb->seq_len > M_MAX_SEQ) {
+        return 0;
+    }
+    for (int i = 0; i < pb->seq_len; i++) {
+        if ((unsigned int)pb->seq[i] >= M_NUM_BUTTONS)
+            return 0;
+    }
+    return memchr(pb->name, '\0', sizeof(pb->name)) != NULL;
+}
+
+/* Returns NULL if any of the bindings is invalid, so that the .prf file
+   gets parsed again. */
+static mbinding_list_t *read_cache(FILE *fp, const cache_hdr_t *hdr) {
+    mbinding_list_t *list = calloc(1, sizeof(mbinding_list_t));
+    if (!list)
+        return NULL;
+    if (hdr->num && !(list->items = malloc(hdr->num * sizeof(mbinding_t)))) {
+        free(list);
+        return NULL;
+    }
+    int ok = fread(list->items, sizeof(mbinding_t), hdr->num, fp) ==
+        (size_t)hdr->num;
+    for (int i = 0; ok && i < hdr->num; i++)
+        ok = valid_binding(&list->items[i]);
+    if (!ok) {
+        free(list->items);
+        free(list);
+        return NULL;
+    }
+    list->num = list->cap = hdr->num;
+    list->double_time = hdr->double_time;
+    list->long_time = hdr->long_time;
+    list->seq_time = hdr->seq_time;
+    list->wheel_detent = hdr->wheel_detent;
+    list->wheel_accel = hdr->wheel_accel;
+    list->cached = 1;
+    return list;
+}
+
+static void save_cache(const char *path, cache_hdr_t *hdr,
+    const mbinding_list_t *list) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return;
+    hdr->num = list->num;
+    hdr->double_time = list->double_time;
+    hdr->long_time = list->long_time;
+    hdr->seq_time = list->seq_time;
+    hdr->wheel_detent = list->wheel_detent;
+    hdr->wheel_accel = list->wheel_accel;
+    int ok = fwrite(hdr, sizeof(*hdr), 1, fp) == 1 &&
+        fwrite(list->items, sizeof(mbinding_t), list->num, fp) ==
+        (size_t)list->num;
     fclose(fp);
-    return num_bindings;
+    /* Don't leave a truncated cache behind. */
+    if (!ok)
+        remove(path);
+}
+
+/**
+ * Loads the bindings from the specified .prf file, or from its cache if
+ * that is still valid. Doesn't call into XPLM or log anything, so it can
+ * run on the parse thread.
+ */
+static mbinding_list_t *load_file(const char *path) {
+    long long start = get_time_ns();
+    struct stat st;
+    if (stat(path, &st))
+        return NULL;
+    char cache[PATH_BUF];
+    int len = snprintf(cache, sizeof(cache), "%s%s", path, CACHE_EXT);
+    /* Without room for the cache's name, the .prf file is always parsed. */
+    int use_cache = len > 0 && len < (int)sizeof(cache);
+    cache_hdr_t old;
+    FILE *cfp = use_cache ? open_cache(cache, &old) : NULL;
+    mbinding_list_t *list = NULL;
+    if (cfp && old.mtime == (long long)st.st_mtime &&
+        old.size == (long long)st.st_size) {
+        list = read_cache(cfp, &old);
+        /* The cache is bad, don't read it again below. */
+        if (!list) {
+            fclose(cfp);
+            cfp = NULL;
+        }
+    }
+    if (!list) {
+        FILE *fp = fopen(path, "rb");
+        char *buf = fp ? malloc((size_t)st.st_size + 1) : NULL;
+        if (!buf) {
+            if (fp)
+                fclose(fp);
+            if (cfp)
+                fclose(cfp);
+            return NULL;
+        }
+        long size = (long)fread(buf, 1, (size_t)st.st_size, fp);
+        buf[size] = '\0';
+        fclose(fp);
+        cache_hdr_t hdr = {
+            .magic = CACHE_MAGIC,
+            .version = CACHE_VERSION,
+            .rec_size = sizeof(mbinding_t),
+            .hash = fnv1a(buf, size),
+            .mtime = st.st_mtime,
+            .size = size
+        };
+        if (cfp && old.hash == hdr.hash && old.size == hdr.size)
+            list = read_cache(cfp, &old);
+        if (!list)
+            list = parse_buf(buf);
+        free(buf);
+        if (cfp)
+            fclose(cfp);
+        cfp = NULL;
+        /* Also rewrites the cache of a touched file, so the next load can
+           skip reading it again. */
+        if (list && use_cache)
+            save_cache(cache, &hdr, list);
+    }
+    if (cfp)
+        fclose(cfp);
+    if (list)
+        list->load_us = (get_time_ns() - start) / 1000;
+    return list;
+}
+
+static void free_list(mbinding_list_t *list) {
+    if (!list)
+        return;
+    free(list->items);
+    free(list);
+}
+
+static int add_wheel(mbinding_tbl_t *tbl, const mbinding_t *pb) {
+    if (!is_wheel(pb->mbutton) || pb->gesture != M_GESTURE_PRESS) {
+        _log("dataref bindings are only supported for the mouse wheel: %s",
+            pb->name);
+        return 0;
+    }
+    XPLMDataRef dr = XPLMFindDataRef(pb->name);
+    if (!dr) {
+        _log("unknown dataref: %s", pb->name);
+        return 0;
+    }
+    XPLMDataTypeID types = XPLMGetDataRefTypes(dr);
+    if (!(types & (xplmType_Float | xplmType_Double)) ||
+        !XPLMCanWriteDataRef(dr)) {
+        _log("dataref is not a writable float or double: %s", pb->name);
+        return 0;
+    }
+    mwheel_t *wheel = &tbl->wheels[pb->mbutton - M_W_FORWARD][pb->mod];
+    /* If a combination is bound more than once, the first one wins. */
+    if (wheel->dr || tbl->cmds[pb->mbutton][pb->mod])
+        return 0;
+    wheel->dr = dr;
+    wheel->type = (types & xplmType_Float) ? xplmType_Float : xplmType_Double;
+    wheel->step = pb->step;
+    return 1;
+}
+
+/**
+ * Resolves the commands of all bindings in a single pass, looking up each
+ * distinct command name only once. Returns an array with the command for
+ * each binding.
+ */
+static XPLMCommandRef *resolve_commands(const mbinding_list_t *list) {
+    XPLMCommandRef *cmds = calloc(list->num + 1, sizeof(XPLMCommandRef));
+    int cap = 16;
+    while (cap < list->num * 2)
+        cap *= 2;
+    int *slots = malloc(cap * sizeof(int));
+    if (!cmds || !slots) {
+        free(cmds);
+        free(slots);
+        return NULL;
+    }
+    memset(slots, -1, cap * sizeof(int));
+    for (int i = 0; i < list->num; i++) {
+        const char *name = list->items[i].name;
+        if (!list->items[i].mbutton || list->items[i].step)
+            continue;
+        unsigned int h = fnv1a(name, strlen(name)) & (cap - 1);
+        while (slots[h] >= 0 && strcmp(list->items[slots[h]].name, name))
+            h = (h + 1) & (cap - 1);
+        if (slots[h] >= 0) {
+            cmds[i] = cmds[slots[h]];
+        } else {
+            slots[h] = i;
+            cmds[i] = XPLMFindCommand(name);
+        }
+    }
+    free(slots);
+    return cmds;
+}
+
+static mbinding_tbl_t *build_table(const mbinding_list_t *list) {
+    mbinding_tbl_t *tbl = calloc(1, sizeof(mbinding_tbl_t));
+    if (!tbl)
+        return NULL;
+    XPLMCommandRef *cmds = resolve_commands(list);
+    if (!cmds) {
+        free(tbl);
+        return NULL;
+    }
+    tbl->long_time = list->long_time;
+    tbl->wheel_detent = list->wheel_detent;
+    tbl->wheel_accel = list->wheel_accel;
+    for (int i = 0; i < list->num; i++) {
+        const mbinding_t *pb = &list->items[i];
+        if (!pb->mbutton) {
+            _log("unknown mouse button identifier: %s", pb->name);
+            continue;
+        }
+        if (pb->step) {
+            if (!add_wheel(tbl, pb))
+                continue;
+            tbl->num++;
+            log_debug("binding  mbutton = %i | mod = %x | dataref = %s | "
+                "step = %f", pb->mbutton, pb->mod, pb->name, pb->step);
+            continue;
+        }
+        XPLMCommandRef cmd = cmds[i];
+        if (!cmd) {
+            _log("unknown command: %s", pb->name);
+            continue;
+        }
+        /* If a combination is bound more than once, the first one wins. */
+        if (pb->gesture == M_GESTURE_DOUBLE || pb->gesture == M_GESTURE_SEQ) {
+            mseq_t *seq = &tbl->seqs[pb->mbutton][pb->mod];
+            if (seq->cmd)
+                continue;
+            seq->cmd = cmd;
+            seq->window = pb->gesture == M_GESTURE_DOUBLE ?
+                list->double_time : list->seq_time;
+            seq->len = pb->seq_len;
+            for (int n = 0; n < pb->seq_len; n++)
+                seq->mbuttons[n] = (unsigned char)pb->seq[n];
+        } else {
+            XPLMCommandRef *slot = pb->gesture == M_GESTURE_LONG ?
+                &tbl->long_cmds[pb->mbutton][pb->mod] :
+                &tbl->cmds[pb->mbutton][pb->mod];
+            if (*slot || (is_wheel(pb->mbutton) &&
+                tbl->wheels[pb->mbutton - M_W_FORWARD][pb->mod].dr)) {
+                continue;
+            }
+            *slot = cmd;
+        }
+        tbl->num++;
+        log_debug("binding  mbutton = %i | gesture = %i | mod = %x | cmd = %s",
+            pb->mbutton, pb->gesture, pb->mod, pb->name);
+    }
+    free(cmds);
+    return tbl;
 }
 
-XPLMCommandRef bindings_get(mbutton_t mbutton, int mod) {
-    for (int i = 0; i < num_bindings; i++) {
-        if (bindings[i].mbutton == mbutton && bindings[i].mod == mod)
-            return bindings[i].cmd;
+static void publish_table(mbinding_tbl_t *tbl) {
+    mbinding_tbl_t *old = atomic_load_ptr(&bindings);
+    atomic_store_ptr(&bindings, tbl);
+    if (!old)
+        return;
+    /* Readers that got in before the swap may still see the old table.
+       New ones can only get the new one, so this doesn't take longer than
+       handling a single event. */
+    while (atomic_add_int(&readers, 0))
+        thread_yield();
+    free(old);
+}
+
+/* Returns 1 if the .prf file's modification time or size have changed. */
+static int prf_changed() {
+    struct stat st;
+    if (stat(prf_path, &st))
+        return 0;
+    if ((long long)st.st_mtime == prf_mtime && (long long)st.st_size == prf_size)
+        return 0;
+    prf_mtime = st.st_mtime;
+    prf_size = st.st_size;
+    return 1;
+}
+
+static void parse_thread_func(void *arg) {
+    parse_result = load_file(prf_path);
+    atomic_store_int(&parse_done, 1);
+}
+
+static void stop_parse_thread() {
+    if (!parse_thread)
+        return;
+    thread_join(parse_thread);
+    parse_thread = NULL;
+    free_list(parse_result);
+    parse_result = NULL;
+}
+
+static float watch_loop_cb(float last_call, float last_loop, int count,
+    void *ref) {
+    if (parse_thread) {
+        if (!atomic_load_int(&parse_done))
+            return WATCH_INTERVAL;
+        thread_join(parse_thread);
+        parse_thread = NULL;
+        if (parse_result) {
+            mbinding_tbl_t *tbl = build_table(parse_result);
+            if (tbl) {
+                publish_table(tbl);
+                _log("reloaded %i mouse bindings from '%s'", tbl->num,
+                    prf_path);
+            }
+        }
+        free_list(parse_result);
+        parse_result = NULL;
+    } else if (prf_changed()) {
+        parse_done = 0;
+        parse_thread = thread_create(parse_thread_func, NULL);
+    }
+    return WATCH_INTERVAL;
+}
+
+int bindings_init() {
+    stop_parse_thread();
+    /* Look for a mouse.prf for the aircraft we're flying first. */
+    char name[MAX_NAME];
+    /* The aircraft's file name directly follows its directory. */
+    snprintf(name, sizeof(name), "%s",
+        path_acft_file()->str + path_acft_dir()->len);
+    char *p = strrchr(name, '.');
+    if (p)
+        strcpy(p + 1, "prf");
+    path_join(prf_path, sizeof(prf_path), path_plugin_dir(), name);
+    mbinding_list_t *list = load_file(prf_path);
+    if (!list) {
+        /* Otherwise probe for mouse.prf in plugin directory. */
+        _log("could not load mouse bindings for aircraft from '%s'",
+            prf_path);
+        path_join(prf_path, sizeof(prf_path), path_plugin_dir(),
+            "mouse.prf");
+        if (!(list = load_file(prf_path))) {
+            _log("could not load mouse bindings from '%s'", prf_path);
+            publish_table(NULL);
+            return 0;
+        }
+    }
+    long long start = get_time_ns();
+    mbinding_tbl_t *tbl = build_table(list);
+    log_info("%s '%s' in %lli us, resolved commands in %lli us",
+        list->cached ? "loaded cached bindings for" : "parsed", prf_path,
+        list->load_us, (get_time_ns() - start) / 1000);
+    free_list(list);
+    publish_table(tbl);
+    /* Remember the file's current state and start watching it. */
+    prf_mtime = prf_size = -1;
+    prf_changed();
+    if (!watch_loop_id) {
+        XPLMCreateFlightLoop_t params = {
+            .structSize = sizeof(XPLMCreateFlightLoop_t),
+            .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+            .refcon = NULL,
+            .callbackFunc = watch_loop_cb
+        };
+        watch_loop_id = XPLMCreateFlightLoop(&params);
     }
-    return NULL;
+    if (watch_loop_id)
+        XPLMScheduleFlightLoop(watch_loop_id, WATCH_INTERVAL, 0);
+    return tbl ? tbl->num : 0;
+}
+
+void bindings_deinit() {
+    if (watch_loop_id)
+        XPLMDestroyFlightLoop(watch_loop_id);
+    watch_loop_id = NULL;
+    stop_parse_thread();
+    publish_table(NULL);
+}
+
+/* Only for use on the sim thread, which is the only one to replace the
+   table. */
+const mbinding_tbl_t *bindings_table() {
+    return atomic_load_ptr(&bindings);
+}
+
+/**
+ * Returns the current table for use on any thread. The table stays valid
+ * until the matching call to bindings_release.
+ */
+const mbinding_tbl_t *bindings_acquire() {
+    atomic_add_int(&readers, 1);
+    return atomic_load_ptr(&bindings);
+}
+
+void bindings_release() {
+    atomic_add_int(&readers, -1);
 }
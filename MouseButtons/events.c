@@ -0,0 +1,254 @@
+/**
+ * MouseButtons - X-Plane 11 Plugin
+ *
+ * Enables the use of extra mouse buttons and allows the right mouse button
+ * and mouse wheel to be re-assigned to arbitrary commands.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+#include "../XP/XPLMProcessing.h"
+
+#define EVENT_NUM_RECS 256 /* must be a power of 2 */
+/* Records kept free for releases, one for every button that can be held */
+#define EVENT_UP_RESERVE M_NUM_BUTTONS
+
+/* Wheel speed in detents per second above which acceleration kicks in */
+#define WHEEL_ACCEL_SPEED   10.0f
+#define WHEEL_MAX_ACCEL     10.0f
+/* Time after which the wheel is considered to have come to rest */
+#define WHEEL_IDLE_NS       250000000LL
+
+/**
+ * Mouse events are not dispatched from within the OS event hooks. Instead
+ * the hooks push a compact record into a single-producer/single-consumer
+ * ring and return right away, which keeps the macOS event tap from being
+ * disabled for timing out and keeps bursts of wheel events from running
+ * command handlers back to back inside the message pump. A flight loop then
+ * drains the ring once per frame.
+ *
+ * The command is resolved in the hook, since the hook has to know whether
+ * to swallow the event, and stored along with the event so that a button's
+ * down and up events always go to the same command, even if the bindings
+ * are reloaded in between. When the ring fills up, new events are dropped,
+ * but a release must never be, or its command would be left held. So the
+ * last EVENT_UP_RESERVE records only take releases, of which there can't
+ * be more outstanding than there are buttons.
+ */
+typedef struct {
+    XPLMCommandRef cmd;
+    mwheel_t wheel;
+    long long time;
+    int delta;
+    unsigned short mod;
+    unsigned char mbutton;
+    unsigned char state;
+} mevent_t;
+
+/**
+ * Wheel deltas are accumulated per axis until they make up a detent, so
+ * that high-resolution wheels, which report fractions of a detent, don't
+ * trigger a command for every event. The smoothed speed of the wheel is
+ * used to scale dataref increments, so that spinning the wheel fast covers
+ * more ground with the same number of writes.
+ *
+ * The speed is measured from the OS timestamps of the events, since the
+ * hooks may see a whole burst of them at once. Some of these timestamps
+ * are coarse (GetMessageTime advances in steps of the system tick), so
+ * deltas of events that share a timestamp are pooled until time moves on.
+ */
+typedef struct {
+    int acc;
+    long long time;
+    /* delta seen since time last advanced */
+    int pending;
+    float speed;
+} maxis_t;
+
+static maxis_t axes[2];
+
+static struct {
+    mevent_t recs[EVENT_NUM_RECS];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    volatile unsigned int dropped;
+    unsigned int reported;
+    XPLMFlightLoopID loop_id;
+    int prof_id;
+} events;
+
+static int push(XPLMCommandRef cmd, const mwheel_t *wheel, mbutton_t mbutton,
+    int mod, int state, int delta, long long time) {
+    unsigned int head = events.head;
+    unsigned int limit = state == M_STATE_UP ? EVENT_NUM_RECS :
+        EVENT_NUM_RECS - EVENT_UP_RESERVE;
+    if (head - atomic_load_int(&events.tail) >= limit) {
+        atomic_add_int(&events.dropped, 1);
+        return 0;
+    }
+    mevent_t *ev = &events.recs[head & (EVENT_NUM_RECS - 1)];
+    ev->cmd = cmd;
+    if (wheel)
+        ev->wheel = *wheel;
+    else
+        memset(&ev->wheel, 0, sizeof(ev->wheel));
+    ev->time = time;
+    ev->delta = delta;
+    ev->mod = (unsigned short)mod;
+    ev->mbutton = (unsigned char)mbutton;
+    ev->state = (unsigned char)state;
+    atomic_store_int(&events.head, head + 1);
+    return 1;
+}
+
+int events_push(XPLMCommandRef cmd, mbutton_t mbutton, int mod, int state,
+    long long time) {
+    return push(cmd, NULL, mbutton, mod, state, 0, time);
+}
+
+int events_push_wheel(XPLMCommandRef cmd, const mwheel_t *wheel,
+    mbutton_t mbutton, int mod, int delta, long long time) {
+    return push(cmd, wheel, mbutton, mod, M_STATE_DOWN | M_STATE_UP, delta,
+        time);
+}
+
+static int is_wheel(mbutton_t mbutton) {
+    return mbutton >= M_W_FORWARD && mbutton <= M_W_RIGHT;
+}
+
+/**
+ * Adds the wheel event's delta to its axis and returns the number of whole
+ * detents that have accumulated. The detents scaled by the wheel's current
+ * acceleration are added to scaled.
+ */
+static int wheel_detents(const mevent_t *ev, const mbinding_tbl_t *tbl,
+    float *scaled) {
+    int vert = ev->mbutton == M_W_FORWARD || ev->mbutton == M_W_BACKWARD;
+    int dir = (ev->mbutton == M_W_FORWARD || ev->mbutton == M_W_RIGHT) ?
+        1 : -1;
+    int detent = tbl ? tbl->wheel_detent : M_WHEEL_DELTA;
+    float accel = tbl ? tbl->wheel_accel : 0;
+    maxis_t *ax = &axes[vert ? 0 : 1];
+    long long dt = ev->time - ax->time;
+    /* Start over when the wheel has come to rest or changed direction. */
+    if (dt > WHEEL_IDLE_NS || dt < 0 || ax->acc * dir < 0) {
+        ax->acc = 0;
+        ax->pending = 0;
+        ax->speed = 0;
+        ax->time = ev->time;
+    } else {
+        ax->pending += ev->delta;
+        if (dt > 0) {
+            float v = ax->pending / (float)detent / (dt * 1e-9f);
+            ax->speed = 0.5f * (ax->speed + v);
+            ax->pending = 0;
+            ax->time = ev->time;
+        }
+    }
+    ax->acc += dir * ev->delta;
+    int n = dir * ax->acc / detent;
+    ax->acc -= dir * n * detent;
+    float f = 1.0f + accel * max(ax->speed - WHEEL_ACCEL_SPEED, 0.0f) /
+        WHEEL_ACCEL_SPEED;
+    *scaled += n * min(f, WHEEL_MAX_ACCEL);
+    return n;
+}
+
+static void dispatch(const mevent_t *ev) {
+    if (ev->state & M_STATE_DOWN)
+        XPLMCommandBegin(ev->cmd);
+    if (ev->state & M_STATE_UP)
+        XPLMCommandEnd(ev->cmd);
+}
+
+static void dispatch_wheel(const mevent_t *ev, int count, float scaled) {
+    if (count > 1) {
+        log_trace("coalesced %i detents of mbutton = %i | mod = %x", count,
+            ev->mbutton, ev->mod);
+    }
+    /* Dataref bindings get a single write however many detents there are. */
+    if (ev->wheel.dr) {
+        float d = ev->wheel.step * scaled;
+        if (ev->wheel.type == xplmType_Float)
+            XPLMSetDataf(ev->wheel.dr, XPLMGetDataf(ev->wheel.dr) + d);
+        else
+            XPLMSetDatad(ev->wheel.dr, XPLMGetDatad(ev->wheel.dr) + d);
+        return;
+    }
+    /* X-Plane commands take no arguments, so there's no way to tell a
+       command handler to act n times over. Each detent has to remain a
+       Begin/End pair of its own, or coalesced detents would be lost. */
+    for (int i = 0; i < count; i++) {
+        XPLMCommandBegin(ev->cmd);
+        XPLMCommandEnd(ev->cmd);
+    }
+}
+
+static float events_loop_cb(float last_call, float last_loop, int count,
+    void *ref) {
+    long long t = prof_begin();
+    unsigned int tail = events.tail;
+    unsigned int head = atomic_load_int(&events.head);
+    while (tail != head) {
+        const mevent_t *ev = &events.recs[tail++ & (EVENT_NUM_RECS - 1)];
+        if (!is_wheel(ev->mbutton)) {
+            dispatch(ev);
+        } else {
+            const mbinding_tbl_t *tbl = bindings_table();
+            float scaled = 0;
+            int n = wheel_detents(ev, tbl, &scaled);
+            /* Coalesce consecutive wheel events that go to the same binding
+               into a single dispatch. */
+            while (tail != head) {
+                const mevent_t *next = &events.recs[tail &
+                    (EVENT_NUM_RECS - 1)];
+                if (next->cmd != ev->cmd || next->wheel.dr != ev->wheel.dr ||
+                    next->mbutton != ev->mbutton) {
+                    break;
+                }
+                tail++;
+                n += wheel_detents(next, tbl, &scaled);
+            }
+            if (n > 0)
+                dispatch_wheel(ev, n, scaled);
+        }
+        /* Release the records only after they've been dispatched. */
+        atomic_store_int(&events.tail, tail);
+    }
+    unsigned int dropped = atomic_load_int(&events.dropped);
+    if (dropped != events.reported) {
+        _log("dropped %u mouse events", dropped - events.reported);
+        events.reported = dropped;
+    }
+    prof_end(events.prof_id, t);
+    return -1.0f;
+}
+
+int events_init() {
+    if (events.loop_id)
+        return 1;
+    events.head = events.tail = 0;
+    memset(axes, 0, sizeof(axes));
+    events.prof_id = prof_register("events_loop_cb");
+    XPLMCreateFlightLoop_t params = {
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .refcon = NULL,
+        .callbackFunc = events_loop_cb
+    };
+    if (!(events.loop_id = XPLMCreateFlightLoop(&params))) {
+        _log("events_init: could not create flight loop");
+        return 0;
+    }
+    XPLMScheduleFlightLoop(events.loop_id, -1.0f, 0);
+    return 1;
+}
+
+void events_deinit() {
+    if (!events.loop_id)
+        return;
+    /* Dispatch whatever is still queued up so no command is left held. */
+    events_loop_cb(0, 0, 0, NULL);
+    XPLMDestroyFlightLoop(events.loop_id);
+    events.loop_id = NULL;
+}
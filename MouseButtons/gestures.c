@@ -0,0 +1,180 @@
+/**
+ * MouseButtons - X-Plane 11 Plugin
+ *
+ * Enables the use of extra mouse buttons and allows the right mouse button
+ * and mouse wheel to be re-assigned to arbitrary commands.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "plugin.h"
+
+/**
+ * Recognizes gestures from the stream of button events. The recognizer is
+ * driven entirely by the timestamps of the events themselves, as taken by
+ * the OS when the input arrived, so there are no timers and it doesn't
+ * matter how late the events are delivered to the hooks. It does a fixed
+ * amount of work per event:
+ *
+ *  - A sequence (or double-click) is recognized on the press that completes
+ *    it, by comparing the few preceding presses against the binding stored
+ *    for that last press.
+ *  - A long press is recognized on release. Only for buttons that have a
+ *    long-press binding is the plain click held back until release; all
+ *    other buttons are dispatched on press as before.
+ *
+ * Runs wherever the OS event hooks run and is only ever fed from a single
+ * thread, so none of the state is shared.
+ */
+typedef struct {
+    mbutton_t mbutton;
+    long long time;
+} mpress_t;
+
+static struct {
+    /* command begun by a button's press, to be ended by its release */
+    XPLMCommandRef active[M_NUM_BUTTONS];
+    /* whether a button's press was consumed, so must be its release */
+    int consumed[M_NUM_BUTTONS];
+    /* time and modifiers of presses held back until release */
+    long long held[M_NUM_BUTTONS];
+    int held_mod[M_NUM_BUTTONS];
+    /* the most recent presses, for recognizing sequences */
+    mpress_t presses[M_MAX_SEQ];
+    unsigned int num_presses;
+} gs;
+
+static int is_wheel(mbutton_t mbutton) {
+    return mbutton >= M_W_FORWARD && mbutton <= M_W_RIGHT;
+}
+
+void gestures_reset() {
+    memset(&gs, 0, sizeof(gs));
+}
+
+static int match_seq(const mseq_t *seq, long long now) {
+    int n = seq->len - 1;
+    if (!seq->cmd || gs.num_presses < (unsigned int)n)
+        return 0;
+    for (int i = 0; i < n; i++) {
+        const mpress_t *p = &gs.presses[(gs.num_presses - n + i) % M_MAX_SEQ];
+        if (p->mbutton != seq->mbuttons[i])
+            return 0;
+        if (!i && now - p->time > seq->window * 1000000LL)
+            return 0;
+    }
+    return 1;
+}
+
+static void add_press(mbutton_t mbutton, long long now) {
+    mpress_t *p = &gs.presses[gs.num_presses++ % M_MAX_SEQ];
+    p->mbutton = mbutton;
+    p->time = now;
+}
+
+/* A held-back press that is used as a modifier no longer counts as a
+   click when it's released. */
+static void cancel_held() {
+    for (int i = 0; i < M_NUM_BUTTONS; i++)
+        gs.held[i] = 0;
+}
+
+static int on_press(const mbinding_tbl_t *tbl, mbutton_t mbutton, int mod,
+    long long now) {
+    cancel_held();
+    const mseq_t *seq = &tbl->seqs[mbutton][mod];
+    if (match_seq(seq, now)) {
+        /* Start over so that a triple-click isn't two double-clicks. */
+        gs.num_presses = 0;
+        gs.consumed[mbutton] = 1;
+        events_push(seq->cmd, mbutton, mod, M_STATE_DOWN | M_STATE_UP,
+            now);
+        return 1;
+    }
+    add_press(mbutton, now);
+    if (tbl->long_cmds[mbutton][mod]) {
+        gs.held[mbutton] = now;
+        gs.held_mod[mbutton] = mod;
+        gs.consumed[mbutton] = 1;
+        return 1;
+    }
+    XPLMCommandRef cmd = tbl->cmds[mbutton][mod];
+    if (!cmd)
+        return 0;
+    gs.consumed[mbutton] = 1;
+    /* Only a press that was queued gets a release, so the reserve for
+       releases in the event ring can't run out. */
+    if (events_push(cmd, mbutton, mod, M_STATE_DOWN, now))
+        gs.active[mbutton] = cmd;
+    return 1;
+}
+
+static int on_release(const mbinding_tbl_t *tbl, mbutton_t mbutton,
+    long long now) {
+    if (!gs.consumed[mbutton])
+        return 0;
+    gs.consumed[mbutton] = 0;
+    if (gs.held[mbutton]) {
+        if (!tbl) {
+            gs.held[mbutton] = 0;
+            return 1;
+        }
+        int mod = gs.held_mod[mbutton];
+        int is_long = now - gs.held[mbutton] >= tbl->long_time * 1000000LL;
+        XPLMCommandRef cmd = is_long ? tbl->long_cmds[mbutton][mod] :
+            tbl->cmds[mbutton][mod];
+        gs.held[mbutton] = 0;
+        if (cmd)
+            events_push(cmd, mbutton, mod, M_STATE_DOWN | M_STATE_UP, now);
+    } else if (gs.active[mbutton]) {
+        events_push(gs.active[mbutton], mbutton, 0, M_STATE_UP, now);
+        gs.active[mbutton] = NULL;
+    }
+    return 1;
+}
+
+static int feed(const mbinding_tbl_t *tbl, mbutton_t mbutton, int mod,
+    int state, int delta, long long now) {
+    if ((unsigned int)mbutton >= M_NUM_BUTTONS ||
+        (unsigned int)mod >= M_NUM_MODS) {
+        return 0;
+    }
+    if (is_wheel(mbutton)) {
+        if (!tbl)
+            return 0;
+        const mwheel_t *wheel = &tbl->wheels[mbutton - M_W_FORWARD][mod];
+        XPLMCommandRef cmd = tbl->cmds[mbutton][mod];
+        if (!cmd && !wheel->dr)
+            return 0;
+        cancel_held();
+        events_push_wheel(cmd, wheel, mbutton, mod, delta, now);
+        return 1;
+    }
+    /* Releases must still be matched up after the bindings are gone. */
+    if (!tbl) {
+        if (state & M_STATE_UP)
+            return on_release(NULL, mbutton, now);
+        return 0;
+    }
+    int consumed = 0;
+    if (state & M_STATE_DOWN)
+        consumed = on_press(tbl, mbutton, mod, now);
+    if (state & M_STATE_UP)
+        consumed = on_release(tbl, mbutton, now);
+    return consumed;
+}
+
+/**
+ * Feeds a button event into the recognizer and queues up any commands it
+ * triggers. For the mouse wheel, delta is the magnitude of the wheel
+ * movement in M_WHEEL_DELTA units. time is the OS timestamp of the event in
+ * nanoseconds; only differences between timestamps are used. Returns 1 if
+ * the event was consumed and must not be passed on to X-Plane.
+ */
+int gestures_feed(mbutton_t mbutton, int mod, int state, int delta,
+    long long time) {
+    /* May be called from the evdev reader thread on Linux. */
+    const mbinding_tbl_t *tbl = bindings_acquire();
+    int consumed = feed(tbl, mbutton, mod, state, delta, time);
+    bindings_release();
+    return consumed;
+}
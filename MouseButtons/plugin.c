@@ -7,6 +7,8 @@
  * Copyright 2019 Torben Knke.
  */
 #include "plugin.h"
+#include <math.h>
+#include <stdlib.h>
 
 #define PLUGIN_NAME         "MouseButtons"
 #define PLUGIN_SIG          "S22.MouseButtons"
@@ -15,6 +17,16 @@
                             "assigned to arbitrary commands."
 #define PLUGIN_VERSION      "1.0"
 
+#if IBM || APL
+/* profiler slot for the window procedure or event tap */
+static int prof_hook = -1;
+#endif
+
+static void load_bindings() {
+    int num_bindings = bindings_init();
+    _log("loaded %i mouse bindings", num_bindings);
+}
+
 /**
  * X-Plane 11 Plugin Entry Point.
  *
@@ -27,6 +39,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
+    path_init();
 
     return 1;
 }
@@ -37,7 +50,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
  * Called when the plugin is about to be unloaded from X-Plane 11.
  */
 PLUGIN_API void XPluginStop(void) {
-    /* nothing to do here */
+    log_deinit();
 }
 
 /**
@@ -47,6 +60,18 @@ PLUGIN_API void XPluginStop(void) {
  * started successfully, otherwise 0.
  */
 PLUGIN_API int XPluginEnable(void) {
+    /* Logging from within the event hooks must not stall the message pump. */
+    log_async_init();
+    prof_init();
+    if (!events_init())
+        return 0;
+    gestures_reset();
+    /* If we're being re-enabled, the user's aircraft is already loaded and
+       there won't be another XPLM_MSG_PLANE_LOADED for it. It may also have
+       changed while we were disabled and not receiving messages. */
+    path_acft_changed();
+    if (path_acft_file()->len)
+        load_bindings();
 #ifdef IBM
     if (!hook_wnd_proc()) {
         _log("could not hook wnd proc");
@@ -55,6 +80,10 @@ PLUGIN_API int XPluginEnable(void) {
     if (!tap_events()) {
         _log("could not tap events");
     }
+#elif LIN
+    if (!open_input_devices()) {
+        _log("could not open input devices");
+    }
 #endif
     return 1;
 }
@@ -69,7 +98,13 @@ PLUGIN_API void XPluginDisable(void) {
     unhook_wnd_proc();
 #elif APL
     untap_events();
+#elif LIN
+    close_input_devices();
 #endif
+    events_deinit();
+    bindings_deinit();
+    prof_deinit();
+    log_async_deinit();
 }
 
 /**
@@ -81,13 +116,14 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
     if (from != XPLM_PLUGIN_XPLANE)
         return;
     if (msg == XPLM_MSG_PLANE_LOADED) {
-        int index = (int)param;
+        int index = (int)(intptr_t)param;
         /* user's plane */
         if (index == XPLM_USER_AIRCRAFT) {
-            /* We cannot call this from XPluginEnable because at that point
-               XPLMGetNthAircraftModel won't return any paths yet...*/
-            int num_bindings = bindings_init();
-            _log("loaded %i mouse bindings", num_bindings);
+            path_acft_changed();
+            /* We cannot call this from XPluginEnable when X-Plane starts up
+               because at that point XPLMGetNthAircraftModel won't return any
+               paths yet...*/
+            load_bindings();
         }
     }
 }
@@ -96,7 +132,8 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, int msg, void *param) {
 static HWND xp_hwnd;
 static WNDPROC old_wnd_proc;
 
-static mbutton_t wm_to_mbutton(UINT msg, WPARAM wParam, int *state) {
+static mbutton_t wm_to_mbutton(UINT msg, WPARAM wParam, int *state,
+    int *delta) {
     switch (msg) {
     case WM_LBUTTONDOWN:
         *state = M_STATE_DOWN;
@@ -124,20 +161,37 @@ static mbutton_t wm_to_mbutton(UINT msg, WPARAM wParam, int *state) {
         return (HIWORD(wParam) & XBUTTON1) ? M_FORWARD : M_BACKWARD;
     case WM_MOUSEWHEEL:
         *state = M_STATE_DOWN | M_STATE_UP;
+        *delta = abs(GET_WHEEL_DELTA_WPARAM(wParam));
         return GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? M_W_FORWARD :
             M_W_BACKWARD;
     case WM_MOUSEHWHEEL:
         *state = M_STATE_DOWN | M_STATE_UP;
+        *delta = abs(GET_WHEEL_DELTA_WPARAM(wParam));
         return GET_WHEEL_DELTA_WPARAM(wParam) > 0 ? M_W_RIGHT : M_W_LEFT;
     default:
         return M_NONE;
     }
 }
 
+/**
+ * Returns the time the current message was posted in nanoseconds.
+ * GetMessageTime is in milliseconds and wraps around after 49.7 days, so
+ * it's extended to 64 bits here.
+ */
+static long long msg_time_ns() {
+    static DWORD last;
+    static long long ms;
+    DWORD t = (DWORD)GetMessageTime();
+    ms += (DWORD)(t - last);
+    last = t;
+    return ms * 1000000LL;
+}
+
 LRESULT CALLBACK xp_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam,
     LPARAM lParam) {
-    int state;
-    mbutton_t mbutton = wm_to_mbutton(msg, wParam, &state);
+    int state, delta = 0;
+    long long t = prof_begin();
+    mbutton_t mbutton = wm_to_mbutton(msg, wParam, &state, &delta);
     if (mbutton != M_NONE) {
         int mod = 0;
         if (wParam & MK_CONTROL)
@@ -156,15 +210,13 @@ LRESULT CALLBACK xp_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam,
             mod |= M_MOD_BMB;
         if (GetKeyState(VK_MENU) < 0)
             mod |= M_MOD_ALT;
-        XPLMCommandRef cmd = bindings_get(mbutton, mod);
-        if (cmd) {
-            if (state & M_STATE_DOWN)
-                XPLMCommandBegin(cmd);
-            if (state & M_STATE_UP)
-                XPLMCommandEnd(cmd);
+        if (gestures_feed(mbutton, mod, state, delta, msg_time_ns())) {
+            prof_end(prof_hook, t);
             return 0;
         }
     }
+    /* Only count our own share, not X-Plane's. */
+    prof_end(prof_hook, t);
     return CallWindowProcA(old_wnd_proc, hwnd, msg, wParam, lParam);
 }
 
@@ -174,6 +226,7 @@ int hook_wnd_proc() {
         _log("could not find X-Plane 11 window");
         return 0;
     }
+    prof_hook = prof_register("xp_wnd_proc");
     old_wnd_proc = (WNDPROC)SetWindowLongPtrA(xp_hwnd, GWLP_WNDPROC,
         (LONG_PTR)&xp_wnd_proc);
     if (!old_wnd_proc) {
@@ -197,8 +250,10 @@ int unhook_wnd_proc() {
 static CFMachPortRef event_tap;
 static CFRunLoopSourceRef loop_src;
 
-static mbutton_t ev_to_mbutton(CGEventType type, CGEventRef ev, int *state) {
+static mbutton_t ev_to_mbutton(CGEventType type, CGEventRef ev, int *state,
+    int *delta) {
     int n;
+    double d;
     switch (type) {
     case kCGEventLeftMouseDown:
         *state = M_STATE_DOWN;
@@ -225,29 +280,44 @@ static mbutton_t ev_to_mbutton(CGEventType type, CGEventRef ev, int *state) {
         case kCGMouseButtonBackward:
             return M_BACKWARD;
         default:
-            _debug("unknown mouse button %i", n);
+            log_debug("unknown mouse button %i", n);
             return M_NONE;
         }
     case kCGEventScrollWheel:
         *state = M_STATE_DOWN | M_STATE_UP;
-        n = CGEventGetIntegerValueField(ev,
-            kCGScrollWheelEventDeltaAxis1);
-        if (n != 0)
-            return n > 0 ? M_W_FORWARD : M_W_BACKWARD;
-        n = CGEventGetIntegerValueField(ev,
-            kCGScrollWheelEventDeltaAxis2);
-        if (n != 0)
-            return n > 0 ? M_W_RIGHT : M_W_LEFT;
+        /* The fixed-point deltas retain the fractional lines reported by
+           high-resolution wheels, which the integer deltas round away. */
+        d = CGEventGetDoubleValueField(ev,
+            kCGScrollWheelEventFixedPtDeltaAxis1);
+        if (d != 0) {
+            *delta = max((int)(fabs(d) * M_WHEEL_DELTA + 0.5), 1);
+            return d > 0 ? M_W_FORWARD : M_W_BACKWARD;
+        }
+        d = CGEventGetDoubleValueField(ev,
+            kCGScrollWheelEventFixedPtDeltaAxis2);
+        if (d != 0) {
+            *delta = max((int)(fabs(d) * M_WHEEL_DELTA + 0.5), 1);
+            return d > 0 ? M_W_RIGHT : M_W_LEFT;
+        }
         return M_NONE;
     default:
         return M_NONE;
     }
 }
 
+/* Event timestamps are in mach_absolute_time units. */
+static long long ev_time_ns(CGEventRef ev) {
+    static mach_timebase_info_data_t tb;
+    if (!tb.denom)
+        mach_timebase_info(&tb);
+    return (long long)(CGEventGetTimestamp(ev) * tb.numer / tb.denom);
+}
+
 CGEventRef cg_event_cb(CGEventTapProxy proxy, CGEventType type,
     CGEventRef ev, void *data) {
-    int state;
-    mbutton_t mbutton = ev_to_mbutton(type, ev, &state);
+    int state, delta = 0;
+    long long t = prof_begin();
+    mbutton_t mbutton = ev_to_mbutton(type, ev, &state, &delta);
     if (mbutton != M_NONE) {
         int mod = 0;
         /* Figure out state of ALT, CONTROL and SHIFT keys. */
@@ -279,17 +349,12 @@ CGEventRef cg_event_cb(CGEventTapProxy proxy, CGEventType type,
             mbutton != M_BACKWARD) {
             mod |= M_MOD_BMB;
         }
-        XPLMCommandRef cmd = bindings_get(mbutton, mod);
-        if (cmd) {
-            if (state & M_STATE_DOWN) {
-                XPLMCommandBegin(cmd);
-            }
-            if (state & M_STATE_UP) {
-                XPLMCommandEnd(cmd);
-            }
+        if (gestures_feed(mbutton, mod, state, delta, ev_time_ns(ev))) {
+            prof_end(prof_hook, t);
             return NULL;
         }
     }
+    prof_end(prof_hook, t);
     return ev;
 }
 
@@ -300,6 +365,7 @@ int tap_events() {
         _log("could not get psn (%i)", err);
         return 0;
     }
+    prof_hook = prof_register("cg_event_cb");
     /* CGEventTapCreateForPid has only been added with 10.11 */
     event_tap = CGEventTapCreateForPSN(&psn, kCGHeadInsertEventTap,
         kCGEventTapOptionDefault,
@@ -337,4 +403,292 @@ int untap_events() {
     event_tap = NULL;
     return 1;
 }
+#elif LIN
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/**
+ * There's no way to hook into X-Plane's own X11 event handling from within a
+ * plugin, so mouse buttons and wheels are read straight from the evdev
+ * devices instead. A reader thread blocks in poll() on all devices at once
+ * and pushes events into the event queue as soon as the kernel delivers
+ * them. Since evdev knows nothing about modifier keys, any keyboards are
+ * opened as well and the state of CTRL, SHIFT and ALT is tracked here.
+ *
+ * Unlike on Windows and macOS, events can't be withheld from X-Plane, so
+ * buttons and wheels that X-Plane itself reacts to are best bound in
+ * combination with a modifier. The devices also deliver events no matter
+ * which window has the focus, so bindings fire while X-Plane is in the
+ * background as well.
+ */
+static struct {
+    int fds[MAX_INPUT_DEVICES];
+    /* whether a device stamps its events with the monotonic clock */
+    int mono[MAX_INPUT_DEVICES];
+    int num_fds;
+    /* Self-pipe used to wake up the reader thread when closing. */
+    int wake[2];
+    thread_t thread;
+    /* M_MOD flags of currently held mouse buttons */
+    int buttons;
+    /* bits of currently held left and right modifier keys */
+    int keys;
+    /* axes for which high-resolution wheel events have been seen */
+    int hi_res;
+} evdev = { .wake = { -1, -1 } };
+
+#define KEY_BIT_CTRL   (1 << 0 | 1 << 1)
+#define KEY_BIT_SHIFT  (1 << 2 | 1 << 3)
+#define KEY_BIT_ALT    (1 << 4 | 1 << 5)
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NUM_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static int test_bit(const unsigned long *bits, int n) {
+    return (bits[n / BITS_PER_LONG] >> (n % BITS_PER_LONG)) & 1;
+}
+
+/* Returns 1 if the device is a mouse with buttons or a wheel, or a keyboard
+   with modifier keys. */
+static int is_input_device(int fd) {
+    unsigned long keys[NUM_LONGS(KEY_CNT)] = { 0 };
+    unsigned long rels[NUM_LONGS(REL_CNT)] = { 0 };
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rels)), rels);
+    return test_bit(keys, BTN_LEFT) || test_bit(keys, KEY_LEFTCTRL) ||
+        test_bit(rels, REL_WHEEL) || test_bit(rels, REL_HWHEEL);
+}
+
+static int add_input_device(const char *path, int check) {
+    if (evdev.num_fds >= MAX_INPUT_DEVICES)
+        return 0;
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    if (check && !is_input_device(fd)) {
+        close(fd);
+        return 0;
+    }
+    /* Event timestamps default to wall-clock time, which may jump. */
+    int clk = CLOCK_MONOTONIC;
+    evdev.mono[evdev.num_fds] = !ioctl(fd, EVIOCSCLOCKID, &clk);
+    log_debug("reading input events from '%s'", path);
+    evdev.fds[evdev.num_fds++] = fd;
+    return 1;
+}
+
+static mbutton_t code_to_mbutton(int code) {
+    switch (code) {
+    case BTN_LEFT:
+        return M_LEFT;
+    case BTN_RIGHT:
+        return M_RIGHT;
+    case BTN_MIDDLE:
+        return M_MIDDLE;
+    case BTN_EXTRA:
+    case BTN_FORWARD:
+        return M_FORWARD;
+    case BTN_SIDE:
+    case BTN_BACK:
+        return M_BACKWARD;
+    default:
+        return M_NONE;
+    }
+}
+
+static int code_to_key_bit(int code) {
+    switch (code) {
+    case KEY_LEFTCTRL:
+        return 1 << 0;
+    case KEY_RIGHTCTRL:
+        return 1 << 1;
+    case KEY_LEFTSHIFT:
+        return 1 << 2;
+    case KEY_RIGHTSHIFT:
+        return 1 << 3;
+    case KEY_LEFTALT:
+        return 1 << 4;
+    case KEY_RIGHTALT:
+        return 1 << 5;
+    default:
+        return 0;
+    }
+}
+
+static int mbutton_to_mod(mbutton_t mbutton) {
+    switch (mbutton) {
+    case M_LEFT:
+        return M_MOD_LMB;
+    case M_RIGHT:
+        return M_MOD_RMB;
+    case M_MIDDLE:
+        return M_MOD_MMB;
+    case M_FORWARD:
+        return M_MOD_FMB;
+    case M_BACKWARD:
+        return M_MOD_BMB;
+    default:
+        return 0;
+    }
+}
+
+static void push_event(mbutton_t mbutton, int state, int delta,
+    long long time) {
+    int mod = evdev.buttons & ~mbutton_to_mod(mbutton);
+    if (evdev.keys & KEY_BIT_CTRL)
+        mod |= M_MOD_CTRL;
+    if (evdev.keys & KEY_BIT_SHIFT)
+        mod |= M_MOD_SHIFT;
+    if (evdev.keys & KEY_BIT_ALT)
+        mod |= M_MOD_ALT;
+    gestures_feed(mbutton, mod, state, delta, time);
+}
+
+static void handle_input_event(const struct input_event *ev,
+    long long time) {
+    if (ev->type == EV_KEY) {
+        /* Ignore auto-repeat. */
+        if (ev->value == 2)
+            return;
+        int bit = code_to_key_bit(ev->code);
+        if (bit) {
+            evdev.keys = ev->value ? (evdev.keys | bit) : (evdev.keys & ~bit);
+            return;
+        }
+        mbutton_t mbutton = code_to_mbutton(ev->code);
+        if (mbutton == M_NONE)
+            return;
+        push_event(mbutton, ev->value ? M_STATE_DOWN : M_STATE_UP, 0, time);
+        int mod = mbutton_to_mod(mbutton);
+        evdev.buttons = ev->value ? (evdev.buttons | mod) :
+            (evdev.buttons & ~mod);
+    } else if (ev->type == EV_REL && ev->value) {
+        /* Devices with high-resolution wheels report both kinds of events,
+           in which case only the high-resolution ones are used. */
+        int vert = ev->code == REL_WHEEL || ev->code == REL_WHEEL_HI_RES;
+        int delta;
+        switch (ev->code) {
+        case REL_WHEEL_HI_RES:
+        case REL_HWHEEL_HI_RES:
+            evdev.hi_res |= 1 << vert;
+            delta = ev->value;
+            break;
+        case REL_WHEEL:
+        case REL_HWHEEL:
+            if (evdev.hi_res & (1 << vert))
+                return;
+            delta = ev->value * M_WHEEL_DELTA;
+            break;
+        default:
+            return;
+        }
+        mbutton_t mbutton = vert ? (delta > 0 ? M_W_FORWARD : M_W_BACKWARD) :
+            (delta > 0 ? M_W_RIGHT : M_W_LEFT);
+        push_event(mbutton, M_STATE_DOWN | M_STATE_UP, abs(delta), time);
+    }
+}
+
+/* Runs on the reader thread, so it mustn't call XPLM or _log. */
+static void input_thread_func(void *arg) {
+    struct pollfd pfds[MAX_INPUT_DEVICES + 1];
+    int n = 0;
+    pfds[n].fd = evdev.wake[0];
+    pfds[n++].events = POLLIN;
+    for (int i = 0; i < evdev.num_fds; i++) {
+        pfds[n].fd = evdev.fds[i];
+        pfds[n++].events = POLLIN;
+    }
+    for (;;) {
+        if (poll(pfds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (pfds[0].revents)
+            return;
+        for (int i = 1; i < n; i++) {
+            if (pfds[i].revents & POLLIN) {
+                struct input_event evs[32];
+                ssize_t len;
+                while ((len = read(pfds[i].fd, evs, sizeof(evs))) > 0) {
+                    for (int k = 0; k < len / (ssize_t)sizeof(evs[0]); k++) {
+                        /* Devices that can't do the monotonic clock are
+                           stamped on arrival instead. */
+                        long long time = evdev.mono[i - 1] ?
+                            evs[k].input_event_sec * 1000000000LL +
+                            evs[k].input_event_usec * 1000LL : get_time_ns();
+                        handle_input_event(&evs[k], time);
+                    }
+                }
+            }
+            /* Device has been unplugged, stop polling it. */
+            if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+                pfds[i].fd = -1;
+        }
+    }
+}
+
+int open_input_devices() {
+    char path[PATH_BUF];
+    evdev.buttons = evdev.keys = evdev.hi_res = 0;
+    /* Allows for reading from a single device only, e.g. a uinput virtual
+       mouse for testing. */
+    ini_gets("input_device", path, sizeof(path), "");
+    if (path[0]) {
+        add_input_device(path, 0);
+    } else {
+        DIR *dir = opendir("/dev/input");
+        if (!dir) {
+            _log("could not open /dev/input (%i)", errno);
+            return 0;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(dir))) {
+            if (strncmp(ent->d_name, "event", 5))
+                continue;
+            snprintf(path, sizeof(path), "/dev/input/%s", ent->d_name);
+            add_input_device(path, 1);
+        }
+        closedir(dir);
+    }
+    if (!evdev.num_fds) {
+        _log("no readable input devices, the user must be a member of "
+            "the 'input' group");
+        return 0;
+    }
+    if (pipe(evdev.wake)) {
+        _log("could not create pipe (%i)", errno);
+        close_input_devices();
+        return 0;
+    }
+    if (!(evdev.thread = thread_create(input_thread_func, NULL))) {
+        close_input_devices();
+        return 0;
+    }
+    return 1;
+}
+
+int close_input_devices() {
+    if (evdev.thread) {
+        char c = 0;
+        if (write(evdev.wake[1], &c, 1) != 1)
+            _log("could not wake input thread (%i)", errno);
+        thread_join(evdev.thread);
+        evdev.thread = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (evdev.wake[i] >= 0)
+            close(evdev.wake[i]);
+        evdev.wake[i] = -1;
+    }
+    for (int i = 0; i < evdev.num_fds; i++)
+        close(evdev.fds[i]);
+    evdev.num_fds = 0;
+    return 1;
+}
 #endif
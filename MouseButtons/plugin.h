@@ -24,6 +24,13 @@ typedef enum {
     M_W_RIGHT
 } mbutton_t;
 
+#define M_NUM_BUTTONS (M_W_RIGHT + 1)
+#define M_NUM_WHEELS  (M_W_RIGHT - M_W_FORWARD + 1)
+
+/* Wheel deltas are normalized to Windows' WHEEL_DELTA units, i.e. a
+   standard wheel reports 120 per detent. */
+#define M_WHEEL_DELTA 120
+
 #define M_MOD_CTRL    (1 << 0)
 #define M_MOD_SHIFT   (1 << 1)
 #define M_MOD_ALT     (1 << 2)
@@ -38,17 +45,87 @@ typedef enum {
 /* Backward Mouse Button (X2) */
 #define M_MOD_BMB     (1 << 7)
 
+#define M_NUM_MODS    (1 << 8)
+
 #define M_STATE_DOWN  (1 << 0)
 #define M_STATE_UP    (1 << 1)
 
+/* Maximum number of button presses in a sequence */
+#define M_MAX_SEQ     4
+
+typedef enum {
+    M_GESTURE_PRESS,
+    M_GESTURE_LONG,
+    M_GESTURE_DOUBLE,
+    M_GESTURE_SEQ
+} mgesture_t;
+
+/**
+ * A sequence of button presses that must all occur within window
+ * milliseconds. Double-clicks are sequences of the same button twice.
+ */
+typedef struct {
+    XPLMCommandRef cmd;
+    int window;
+    int len;
+    unsigned char mbuttons[M_MAX_SEQ];
+} mseq_t;
+
+/**
+ * Binding of a mouse wheel to a float or double dataref that is incremented
+ * by step for each detent.
+ */
+typedef struct {
+    XPLMDataRef dr;
+    XPLMDataTypeID type;
+    float step;
+} mwheel_t;
+
+/**
+ * Bindings are stored in tables indexed directly by button and modifier
+ * mask, so looking up the command for a mouse event in the event hooks is
+ * a single load. Sequences are stored under the button of their last press.
+ */
+typedef struct {
+    XPLMCommandRef cmds[M_NUM_BUTTONS][M_NUM_MODS];
+    XPLMCommandRef long_cmds[M_NUM_BUTTONS][M_NUM_MODS];
+    mseq_t seqs[M_NUM_BUTTONS][M_NUM_MODS];
+    mwheel_t wheels[M_NUM_WHEELS][M_NUM_MODS];
+    /* minimum duration of a long press, in milliseconds */
+    int long_time;
+    /* wheel delta that makes up one detent, in M_WHEEL_DELTA units */
+    int wheel_detent;
+    /* wheel acceleration factor, 0 turns acceleration off */
+    float wheel_accel;
+    int num;
+} mbinding_tbl_t;
+
 /* bindings */
 int bindings_init();
-XPLMCommandRef bindings_get(mbutton_t mbutton, int mod);
+void bindings_deinit();
+const mbinding_tbl_t *bindings_table();
+const mbinding_tbl_t *bindings_acquire();
+void bindings_release();
+
+/* gestures */
+void gestures_reset();
+int gestures_feed(mbutton_t mbutton, int mod, int state, int delta,
+    long long time);
+
+/* events */
+int events_init();
+void events_deinit();
+int events_push(XPLMCommandRef cmd, mbutton_t mbutton, int mod, int state,
+    long long time);
+int events_push_wheel(XPLMCommandRef cmd, const mwheel_t *wheel,
+    mbutton_t mbutton, int mod, int delta, long long time);
 
 #ifdef IBM
 int hook_wnd_proc();
 int unhook_wnd_proc();
 #elif APL
+#include <mach/mach_time.h>
+
 /**
  * Quartz supports up to 32 mouse buttons. The first 3 buttons
  * are specified using constants. Additional buttons are specified
@@ -64,6 +141,18 @@ int unhook_wnd_proc();
 
 int tap_events();
 int untap_events();
+#elif LIN
+#include <linux/input.h>
+
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES 0x0b
+#define REL_HWHEEL_HI_RES 0x0c
+#endif
+
+#define MAX_INPUT_DEVICES 16
+
+int open_input_devices();
+int close_input_devices();
 #endif
 
 #endif /* _PLUGIN_H_ */
@@ -36,6 +36,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
+    path_init();
     /* Don't invoke plugins own enable functions just yet because we're going
        to get a XPluginEnable call from X-Plane after this that's going to be
        forwarded to the plugins. */
@@ -50,6 +51,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
  */
 PLUGIN_API void XPluginStop(void) {
     unload_plugins();
+    log_deinit();
 }
 
 /**
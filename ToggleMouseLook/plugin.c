@@ -18,6 +18,11 @@ static XPLMCommandRef hold_mouse_look;
 static int mouse_look;
 static int screen_height;
 static float magenta[] = { 1.0f, 0, 1.0f };
+/* profiler slots */
+static int prof_draw;
+static int prof_toggle;
+static int prof_hold;
+static int prof_hook = -1;
 
  /**
  * X-Plane 11 Plugin Entry Point.
@@ -31,7 +36,10 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
     sprintf(name, "%s (v%s)", PLUGIN_NAME, PLUGIN_VERSION);
     strcpy(sig, PLUGIN_SIG);
     strcpy(desc, PLUGIN_DESCRIPTION);
-
+    path_init();
+    prof_draw = prof_register("draw_cb");
+    prof_toggle = prof_register("toggle_cb");
+    prof_hold = prof_register("hold_cb");
     return 1;
 }
 
@@ -41,7 +49,7 @@ PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
 * Called when the plugin is about to be unloaded from X-Plane 11.
 */
 PLUGIN_API void XPluginStop(void) {
-    /* nothing to do here */
+    log_deinit();
 }
 
 /**
@@ -51,6 +59,7 @@ PLUGIN_API void XPluginStop(void) {
 * started successfully, otherwise 0.
 */
 PLUGIN_API int XPluginEnable(void) {
+    prof_init();
     toggle_mouse_look = cmd_create("MouseLook/Toggle",
         "Toggle mouse-look on or off", toggle_cb, NULL);
     hold_mouse_look = cmd_create("MouseLook/Hold", "Hold key to look around",
@@ -82,6 +91,7 @@ PLUGIN_API void XPluginDisable(void) {
 #elif APL
     untap_events();
 #endif
+    prof_deinit();
 }
 
 /**
@@ -102,27 +112,33 @@ void right_click() {
 }
 
 int toggle_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *data) {
+    long long t = prof_begin();
     if (phase == xplm_CommandBegin) {
         right_click();
     }
+    prof_end(prof_toggle, t);
     return 0;
 }
 
 int hold_cb(XPLMCommandRef cmd, XPLMCommandPhase phase, void *data) {
+    long long t = prof_begin();
     switch (phase) {
     case xplm_CommandBegin:
     case xplm_CommandEnd:
         right_click();
         break;
     }
+    prof_end(prof_hold, t);
     return 0;
 }
 
 int draw_cb(XPLMDrawingPhase phase, int before, void *ref) {
+    long long t = prof_begin();
     if (mouse_look) {
         XPLMDrawString(magenta, 20, screen_height - 20, "MOUSELOOK", NULL,
             xplmFont_Proportional);
     }
+    prof_end(prof_draw, t);
     return 1;
 }
 
@@ -132,19 +148,24 @@ static WNDPROC old_wnd_proc;
 
 LRESULT CALLBACK xp_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam,
     LPARAM lParam) {
+    long long t = prof_begin();
+    int eat = 0;
     switch (msg) {
     case WM_RBUTTONDOWN:
         mouse_look = !mouse_look;
         if (mouse_look)
             XPLMGetScreenSize(NULL, &screen_height);
         else
-            return 0;
+            eat = 1;
         break;
     case WM_RBUTTONUP:
-        if (mouse_look)
-            return 0;
+        eat = mouse_look;
         break;
     }
+    /* Only count our own share, not X-Plane's. */
+    prof_end(prof_hook, t);
+    if (eat)
+        return 0;
     return CallWindowProcA(old_wnd_proc, hwnd, msg, wParam, lParam);
 }
 
@@ -154,6 +175,7 @@ int hook_wnd_proc() {
         _log("could not find X-Plane 11 window");
         return 0;
     }
+    prof_hook = prof_register("xp_wnd_proc");
     old_wnd_proc = (WNDPROC) SetWindowLongPtrA(xp_hwnd, GWLP_WNDPROC,
         (LONG_PTR) &xp_wnd_proc);
     if (!old_wnd_proc) {
@@ -179,24 +201,27 @@ static CFRunLoopSourceRef loop_src;
 
 CGEventRef cg_event_cb(CGEventTapProxy proxy, CGEventType type,
     CGEventRef ev, void *data) {
+    long long t = prof_begin();
+    int eat = 0;
     switch (type) {
     case kCGEventRightMouseDown:
         mouse_look = !mouse_look;
         if (mouse_look)
             XPLMGetScreenSize(NULL, &screen_height);
         else
-            return NULL;
+            eat = 1;
         break;
     case kCGEventRightMouseUp:
-        if (mouse_look)
-            return NULL;
+        eat = mouse_look;
         break;
     }
-    return ev;
+    prof_end(prof_hook, t);
+    return eat ? NULL : ev;
 }
 
 int tap_events() {
     ProcessSerialNumber psn;
+    prof_hook = prof_register("cg_event_cb");
     OSErr err = GetCurrentProcess(&psn);
     if (err != noErr) {
       _log("could not get psn (%i)", err);
@@ -0,0 +1,99 @@
+/**
+ * Utility library for X-Plane 11 Plugins.
+ *
+ * Static library containing common functionality for stuff like logging and
+ * dealing with configuration files. Linked against by most plugins in the
+ * solution.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "util.h"
+#include <math.h>
+
+#define DR_MAX_STAGED   16
+#define DR_EPSILON      1e-5f
+
+/**
+ * Staging area for float datarefs that are written every frame. Writes
+ * only update a shadow copy and are handed to X-Plane all at once by
+ * dr_flush, and only if the value has changed by more than DR_EPSILON since
+ * it was last written. Reads are answered from the shadow copy once it is
+ * valid, so a plugin that is the only writer of a dataref doesn't have to
+ * read it back from X-Plane either. If something else may have changed the
+ * datarefs in the meantime, dr_invalidate forces the next reads to go to
+ * X-Plane again.
+ */
+typedef struct {
+    XPLMDataRef ref;
+    /* value last written to or read from X-Plane */
+    float val;
+    float staged;
+    int dirty;
+    int valid;
+} dr_staged_t;
+
+static dr_staged_t staged[DR_MAX_STAGED];
+static int num_staged;
+
+/**
+ * Looks up the specified float dataref and adds it to the staging area.
+ * Returns the id to use with the other dr functions, or -1 on failure.
+ */
+int dr_stage(const char *name) {
+    if (num_staged >= DR_MAX_STAGED) {
+        _log("dr_stage: too many datarefs, can't add %s", name);
+        return -1;
+    }
+    XPLMDataRef ref = XPLMFindDataRef(name);
+    if (!ref) {
+        _log("dr_stage: could not find dataref %s", name);
+        return -1;
+    }
+    dr_staged_t *d = &staged[num_staged];
+    memset(d, 0, sizeof(*d));
+    d->ref = ref;
+    return num_staged++;
+}
+
+float dr_getf(int id) {
+    dr_staged_t *d = &staged[id];
+    if (d->dirty)
+        return d->staged;
+    if (!d->valid) {
+        d->val = XPLMGetDataf(d->ref);
+        d->valid = 1;
+    }
+    return d->val;
+}
+
+void dr_setf(int id, float val) {
+    dr_staged_t *d = &staged[id];
+    d->staged = val;
+    d->dirty = !d->valid || fabsf(val - d->val) > DR_EPSILON;
+}
+
+/* Writes all changed values to X-Plane. Returns the number of writes. */
+int dr_flush() {
+    int n = 0;
+    for (int i = 0; i < num_staged; i++) {
+        dr_staged_t *d = &staged[i];
+        if (!d->dirty)
+            continue;
+        XPLMSetDataf(d->ref, d->staged);
+        d->val = d->staged;
+        d->valid = 1;
+        d->dirty = 0;
+        n++;
+    }
+    return n;
+}
+
+void dr_invalidate() {
+    for (int i = 0; i < num_staged; i++)
+        staged[i].valid = 0;
+}
+
+void dr_clear() {
+    memset(staged, 0, sizeof(staged));
+    num_staged = 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * Utility library for X-Plane 11 Plugins.
+ *
+ * Static library containing common functionality for stuff like logging and
+ * dealing with configuration files. Linked against by most plugins in the
+ * solution.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "util.h"
+#include <stdlib.h>
+#ifndef IBM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Thin wrapper around file mappings. The file is created, or truncated if
+ * it exists, and grown to the requested size up-front, so writing to the
+ * mapping never allocates and the OS flushes it to disk in the background,
+ * even if X-Plane crashes.
+ */
+typedef struct {
+    void *ptr;
+    unsigned int size;
+#ifdef IBM
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} fmap_ctx_t;
+
+fmap_t fmap_create(const char *path, unsigned int size) {
+    fmap_ctx_t *ctx = calloc(1, sizeof(fmap_ctx_t));
+    if (!ctx)
+        return NULL;
+    ctx->size = size;
+#ifdef IBM
+    ctx->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (ctx->file == INVALID_HANDLE_VALUE) {
+        _log("fmap_create: could not create '%s' (%i)", path, GetLastError());
+        free(ctx);
+        return NULL;
+    }
+    ctx->mapping = CreateFileMappingA(ctx->file, NULL, PAGE_READWRITE, 0,
+        size, NULL);
+    if (!ctx->mapping || !(ctx->ptr = MapViewOfFile(ctx->mapping,
+        FILE_MAP_WRITE, 0, 0, size))) {
+        _log("fmap_create: could not map '%s' (%i)", path, GetLastError());
+        if (ctx->mapping)
+            CloseHandle(ctx->mapping);
+        CloseHandle(ctx->file);
+        free(ctx);
+        return NULL;
+    }
+#else
+    ctx->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ctx->fd < 0) {
+        _log("fmap_create: could not create '%s'", path);
+        free(ctx);
+        return NULL;
+    }
+    void *p = MAP_FAILED;
+    if (!ftruncate(ctx->fd, size))
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, 0);
+    if (p == MAP_FAILED) {
+        _log("fmap_create: could not map '%s'", path);
+        close(ctx->fd);
+        free(ctx);
+        return NULL;
+    }
+    ctx->ptr = p;
+#endif
+    return ctx;
+}
+
+void *fmap_ptr(fmap_t m) {
+    return m ? ((fmap_ctx_t*)m)->ptr : NULL;
+}
+
+/**
+ * Unmaps the file. Its size stays what it was created with.
+ */
+void fmap_close(fmap_t m) {
+    fmap_ctx_t *ctx = (fmap_ctx_t*)m;
+    if (!ctx)
+        return;
+#ifdef IBM
+    UnmapViewOfFile(ctx->ptr);
+    CloseHandle(ctx->mapping);
+    CloseHandle(ctx->file);
+#else
+    munmap(ctx->ptr, ctx->size);
+    close(ctx->fd);
+#endif
+    free(ctx);
+}
@@ -8,108 +8,310 @@
  * Copyright 2019 Torben Knke.
  */
 #include "util.h"
+#include <stdlib.h>
+#include <ctype.h>
 
-static char ini_path[MAX_PATH];
-
-#define INI_FILE_NAME "settings.ini"
 #define INI_SECT_NAME "settings"
+#define INI_MIN_SLOTS 64
 
-static char *ini_get_path() {
-    if (ini_path[0])
-        return ini_path;
-    if (!get_plugin_dir(ini_path, MAX_PATH)) {
-        _log("ini_get_path: could not get plugin dir");
-        return NULL;
+/**
+ * The settings file is parsed exactly once into an open-addressing hash
+ * table so that lookups don't have to touch the file system. All strings
+ * (section names, keys and values) are interned into a single pool and
+ * referred to by their offset, so that growing the pool does not invalidate
+ * any references. Offset 0 is reserved for the empty string and doubles as
+ * the marker for unused slots.
+ */
+typedef struct {
+    unsigned int hash;
+    unsigned int sect;
+    unsigned int key;
+    unsigned int val;
+} ini_entry_t;
+
+static struct {
+    char *pool;
+    unsigned int pool_len;
+    unsigned int pool_cap;
+    /* intern table, holds pool offsets */
+    unsigned int *strs;
+    unsigned int num_strs;
+    unsigned int strs_cap;
+    /* key/value index */
+    ini_entry_t *entries;
+    unsigned int num_entries;
+    unsigned int entries_cap;
+    int loaded;
+} ini;
+
+/* FNV-1a over the lower-cased string since keys are case-insensitive. */
+static unsigned int ini_hash(const char *s, unsigned int h) {
+    while (*s) {
+        h ^= (unsigned char)tolower((unsigned char)*s++);
+        h *= 16777619u;
     }
-    return strcat(ini_path, INI_FILE_NAME);
+    return h;
 }
 
-int ini_geti(const char *name, int def) {
-#ifdef IBM
-    return GetPrivateProfileIntA(INI_SECT_NAME, name, def,
-        ini_get_path());
-#else
-    char buf[32];
-    ini_gets(name, buf, 32, "nan");
-    if (!strcmp(buf, "nan"))
-        return def;
-    return atoi(buf);
-#endif
+static unsigned int ini_hash_key(const char *sect, const char *key) {
+    return ini_hash(key, ini_hash(sect, 2166136261u) ^ '\n');
 }
 
-int ini_seti(const char *name, int val) {
-    char *f = ini_get_path();
-#ifdef IBM
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%i", val);
-    return WritePrivateProfileStringA(INI_SECT_NAME, name, buf, f);
-#endif
+static unsigned int ini_hash_str(const char *s, unsigned int len) {
+    unsigned int h = 2166136261u;
+    for (unsigned int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
 }
 
-float ini_getf(const char *name, float def) {
-    char buf[32];
-    ini_gets(name, buf, 32, "nan");
-    if (!strcmp(buf, "nan"))
-        return def;
-    return atof(buf);
+static int ini_grow_strs() {
+    unsigned int cap = ini.strs_cap ? ini.strs_cap * 2 : INI_MIN_SLOTS;
+    unsigned int *strs = calloc(cap, sizeof(unsigned int));
+    if (!strs)
+        return 0;
+    for (unsigned int i = 0; i < ini.strs_cap; i++) {
+        unsigned int off = ini.strs[i];
+        if (!off)
+            continue;
+        const char *s = ini.pool + off;
+        unsigned int j = ini_hash_str(s, strlen(s)) & (cap - 1);
+        while (strs[j])
+            j = (j + 1) & (cap - 1);
+        strs[j] = off;
+    }
+    free(ini.strs);
+    ini.strs = strs;
+    ini.strs_cap = cap;
+    return 1;
 }
 
-int ini_setf(const char *name, float val) {
-
+/**
+ * Returns the pool offset of the specified string, adding it to the pool
+ * if it hasn't been seen before. Returns 0 for the empty string or if
+ * memory could not be allocated.
+ */
+static unsigned int ini_intern(const char *s, unsigned int len) {
+    if (!len)
+        return 0;
+    if ((ini.num_strs + 1) * 4 > ini.strs_cap * 3 && !ini_grow_strs())
+        return 0;
+    unsigned int i = ini_hash_str(s, len) & (ini.strs_cap - 1);
+    while (ini.strs[i]) {
+        const char *p = ini.pool + ini.strs[i];
+        if (!strncmp(p, s, len) && !p[len])
+            return ini.strs[i];
+        i = (i + 1) & (ini.strs_cap - 1);
+    }
+    /* First byte of the pool is the empty string. */
+    unsigned int need = max(ini.pool_len, 1) + len + 1;
+    if (need > ini.pool_cap) {
+        char *pool = realloc(ini.pool, max(ini.pool_cap * 2, need));
+        if (!pool)
+            return 0;
+        ini.pool = pool;
+        ini.pool_cap = max(ini.pool_cap * 2, need);
+    }
+    if (!ini.pool_len) {
+        ini.pool[0] = '\0';
+        ini.pool_len = 1;
+    }
+    unsigned int off = ini.pool_len;
+    memcpy(ini.pool + off, s, len);
+    ini.pool[off + len] = '\0';
+    ini.pool_len += len + 1;
+    ini.strs[i] = off;
+    ini.num_strs++;
+    return off;
 }
 
-void ini_gets(const char *name, char *buf, int size, const char *def) {
-    char *f = ini_get_path();
-#ifdef IBM
-    GetPrivateProfileStringA(INI_SECT_NAME, name, def, buf, size, f);
-#else
-    FILE *fp = fopen(f, "r");
-    if (!fp) {
-        strcpy(buf, def);
-        return;
+static ini_entry_t *ini_slot(unsigned int hash, const char *sect,
+    const char *key) {
+    unsigned int i = hash & (ini.entries_cap - 1);
+    while (ini.entries[i].key) {
+        ini_entry_t *e = &ini.entries[i];
+        if (e->hash == hash && !_stricmp(ini.pool + e->key, key) &&
+            !_stricmp(ini.pool + e->sect, sect)) {
+            return e;
+        }
+        i = (i + 1) & (ini.entries_cap - 1);
     }
-    char line[128];
-    while (fgets(line, sizeof(line), fp)) {
-        char *p = line;
-        while (*p && (*p == ' ' || *p == '\t'))
-            p++;
-        if (*p == '[' || *p == ';')
-            continue;
-        char *q = strchr(p, '=');
-        if (!q)
+    return &ini.entries[i];
+}
+
+static int ini_grow_entries() {
+    unsigned int cap = ini.entries_cap ? ini.entries_cap * 2 : INI_MIN_SLOTS;
+    ini_entry_t *entries = calloc(cap, sizeof(ini_entry_t));
+    if (!entries)
+        return 0;
+    for (unsigned int i = 0; i < ini.entries_cap; i++) {
+        ini_entry_t *e = &ini.entries[i];
+        if (!e->key)
             continue;
-        char n[128] = { 0 };
-        strncpy(n, p, q - p);
-        if (strncmp(name, n, strlen(name)))
+        unsigned int j = e->hash & (cap - 1);
+        while (entries[j].key)
+            j = (j + 1) & (cap - 1);
+        entries[j] = *e;
+    }
+    free(ini.entries);
+    ini.entries = entries;
+    ini.entries_cap = cap;
+    return 1;
+}
+
+static int ini_put(const char *sect, const char *key, const char *val) {
+    if ((ini.num_entries + 1) * 4 > ini.entries_cap * 3 &&
+        !ini_grow_entries()) {
+        return 0;
+    }
+    unsigned int hash = ini_hash_key(sect, key);
+    ini_entry_t *e = ini_slot(hash, sect, key);
+    if (!e->key) {
+        if (!(e->key = ini_intern(key, strlen(key))))
+            return 0;
+        e->hash = hash;
+        e->sect = ini_intern(sect, strlen(sect));
+        ini.num_entries++;
+    }
+    e->val = ini_intern(val, strlen(val));
+    return 1;
+}
+
+static void ini_free() {
+    free(ini.pool);
+    free(ini.strs);
+    free(ini.entries);
+    memset(&ini, 0, sizeof(ini));
+}
+
+static char *ini_trim(char *s) {
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' ||
+        e[-1] == '\n')) {
+        e--;
+    }
+    *e = '\0';
+    return s;
+}
+
+static void ini_parse(char *buf) {
+    char sect[MAX_NAME] = { 0 };
+    char *line = buf;
+    while (line) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        char *p = ini_trim(line);
+        line = next;
+        if (*p == ';' || *p == '#' || !*p)
             continue;
-        q++;
-        while (*q && (*q == ' ' || *q == '\t'))
-            q++;
-        strcpy(n, q);
-        if((q = strrchr(n, ';')))
-            *q = '\0';
-        else {
-            q = n + strlen(n) - 1;
-            if (*q == '\n') {
+        if (*p == '[') {
+            char *q = strchr(p, ']');
+            if (q) {
                 *q = '\0';
-                q--;
-                /* remove carriage if it's a windows file */
-                if (*q == '\r')
-                    *q = '\0';
+                snprintf(sect, sizeof(sect), "%s", ini_trim(p + 1));
             }
+            continue;
         }
-        strcpy(buf, n);
+        char *q = strchr(p, '=');
+        if (!q)
+            continue;
+        *q++ = '\0';
+        /* strip trailing comments */
+        char *c = strrchr(q, ';');
+        if (c)
+            *c = '\0';
+        p = ini_trim(p);
+        if (*p)
+            ini_put(sect, p, ini_trim(q));
+    }
+}
+
+static int ini_load() {
+    if (ini.loaded)
+        return 1;
+    /* Mark as loaded up-front so that logging (which looks up the debug
+       setting) can't recurse into here. */
+    ini.loaded = 1;
+    const char *f = path_ini_file()->str;
+    if (!f[0]) {
+        _log("ini_load: could not get plugin dir");
+        return 0;
+    }
+    long long start = get_time_ns();
+    FILE *fp = fopen(f, "rb");
+    if (!fp)
+        return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = size >= 0 ? malloc(size + 1) : NULL;
+    if (!buf) {
         fclose(fp);
-        return;
+        return 0;
     }
+    size = fread(buf, 1, size, fp);
+    buf[size] = '\0';
     fclose(fp);
-    strcpy(buf, def);
-#endif
+    ini_parse(buf);
+    free(buf);
+    log_debug("ini_load: indexed %u keys from '%s' in %lli us",
+        ini.num_entries, f, (get_time_ns() - start) / 1000);
+    return 1;
+}
+
+static const char *ini_find(const char *name) {
+    if (!ini_load() || !ini.num_entries)
+        return NULL;
+    ini_entry_t *e = ini_slot(ini_hash_key(INI_SECT_NAME, name),
+        INI_SECT_NAME, name);
+    return e->key ? ini.pool + e->val : NULL;
+}
+
+int ini_reload() {
+    ini_free();
+    return ini_load();
+}
+
+int ini_geti(const char *name, int def) {
+    const char *v = ini_find(name);
+    return v ? atoi(v) : def;
+}
+
+int ini_seti(const char *name, int val) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%i", val);
+    return ini_sets(name, buf);
+}
+
+float ini_getf(const char *name, float def) {
+    const char *v = ini_find(name);
+    return v ? (float)atof(v) : def;
+}
+
+int ini_setf(const char *name, float val) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%f", val);
+    return ini_sets(name, buf);
+}
+
+void ini_gets(const char *name, char *buf, int size, const char *def) {
+    const char *v = ini_find(name);
+    snprintf(buf, size, "%s", v ? v : def);
 }
 
 int ini_sets(const char *name, const char *val) {
-    char *f = ini_get_path();
+    /* Keep the in-memory index in sync so subsequent reads see the new
+       value. */
+    ini_load();
+    ini_put(INI_SECT_NAME, name, val);
 #ifdef IBM
+    const char *f = path_ini_file()->str;
     return WritePrivateProfileStringA(INI_SECT_NAME, name, val, f);
+#else
+    return 1;
 #endif
-}
\ No newline at end of file
+}
@@ -8,37 +8,208 @@
  * Copyright 2019 Torben Knke.
  */
 #include "util.h"
+#include "../XP/XPLMProcessing.h"
 
-static int debug_enabled = -1;
-static char plugin_name[MAX_NAME];
+int log_level = -1;
+static XPLMDataRef log_level_dr;
+
+static const char *log_tags[] = {
+    " (trace)", " (debug)", "", " (warn)", " (error)"
+};
+
+#define LOG_REC_SIZE    512
+#define LOG_NUM_RECS    128 /* must be a power of 2 */
+#define LOG_BATCH_SIZE  8192
+
+/**
+ * Single-producer/single-consumer ring of preformatted log records. Records
+ * are formatted in-place by _log/_debug on the sim thread and handed to
+ * XPLMDebugString in batches from a flight loop, so a burst of log calls
+ * costs a vsnprintf each instead of a write to Log.txt each. If the ring is
+ * full, records are dropped and counted rather than blocking the caller.
+ */
+typedef struct {
+    char buf[LOG_REC_SIZE];
+} log_rec_t;
+
+static struct {
+    log_rec_t recs[LOG_NUM_RECS];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    volatile unsigned int dropped;
+    unsigned int reported;
+    XPLMFlightLoopID loop_id;
+    int enabled;
+} log_ring;
 
 static const char *get_name() {
-    if (plugin_name[0])
-        return plugin_name;
-    get_plugin_name(plugin_name, MAX_NAME);
-    return plugin_name;
+    return path_plugin_name()->str;
+}
+
+static void log_write(const char *tag, const char *fmt, va_list args) {
+    char *out, buf[2048];
+    int size;
+    unsigned int head = 0;
+    if (log_ring.enabled) {
+        head = log_ring.head;
+        if (head - atomic_load_int(&log_ring.tail) >= LOG_NUM_RECS) {
+            atomic_add_int(&log_ring.dropped, 1);
+            return;
+        }
+        out = log_ring.recs[head & (LOG_NUM_RECS - 1)].buf;
+        size = LOG_REC_SIZE;
+    } else {
+        out = buf;
+        size = sizeof(buf);
+    }
+    int n = snprintf(out, size, "[%s]%s: ", get_name(), tag);
+    if (n < 0 || n >= size - 2)
+        n = 0;
+    int m = vsnprintf(out + n, size - n - 2, fmt, args);
+    if (m < 0)
+        m = 0;
+    n = min(n + m, size - 3);
+    strcpy(out + n, "\r\n");
+    if (log_ring.enabled)
+        atomic_store_int(&log_ring.head, head + 1);
+    else
+        XPLMDebugString(out);
+}
+
+static int log_level_get(void *ref) {
+    return log_level;
+}
+
+static void log_level_set(void *ref, int val) {
+    log_set_level(val);
+}
+
+static void log_level_init() {
+    /* Anything logged while reading the settings is filtered at INFO. */
+    log_level = LOG_LVL_INFO;
+    int lvl = ini_geti("log_level", -1);
+    /* Fall back to the older boolean setting. */
+    if (lvl < 0)
+        lvl = ini_geti("debug", 0) ? LOG_LVL_DEBUG : LOG_LVL_INFO;
+    log_set_level(lvl);
+    /* Expose the level as a dataref so it can be changed at runtime, e.g.
+       through DataRefEditor. */
+    char name[PATH_BUF + 16];
+    snprintf(name, sizeof(name), "%s/log_level", get_name());
+    log_level_dr = XPLMRegisterDataAccessor(name, xplmType_Int, 1,
+        log_level_get, log_level_set, NULL, NULL, NULL, NULL, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+void log_set_level(int lvl) {
+    log_level = min(max(lvl, LOG_LVL_TRACE), LOG_LVL_NONE);
+}
+
+void log_printf(int lvl, const char *fmt, ...) {
+    if (log_level < 0)
+        log_level_init();
+    if (lvl < log_level || lvl < LOG_LVL_TRACE || lvl >= LOG_LVL_NONE)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    log_write(log_tags[lvl], fmt, args);
+    va_end(args);
+}
+
+void log_deinit() {
+    if (log_level_dr)
+        XPLMUnregisterDataAccessor(log_level_dr);
+    log_level_dr = NULL;
+    log_level = -1;
 }
 
 void _log(const char *fmt, ...) {
-    char buf[2048], out[2048];
     va_list args;
     va_start(args, fmt);
-    vsprintf(buf, fmt, args);
-    sprintf(out, "[%s]: %s\r\n", get_name(), buf);
-    XPLMDebugString(out);
+    log_write("", fmt, args);
     va_end(args);
 }
 
 void _debug(const char *fmt, ...) {
-    if (debug_enabled < 0)
-        debug_enabled = ini_geti("debug", 0);
-    if (!debug_enabled)
+    if (log_level < 0)
+        log_level_init();
+    if (log_level > LOG_LVL_DEBUG)
         return;
-    char buf[2048], out[2048];
     va_list args;
     va_start(args, fmt);
-    vsprintf(buf, fmt, args);
-    sprintf(out, "[%s] (debug): %s\r\n", get_name(), buf);
-    XPLMDebugString(out);
+    log_write(log_tags[LOG_LVL_DEBUG], fmt, args);
     va_end(args);
 }
+
+static void log_async_drain() {
+    char batch[LOG_BATCH_SIZE];
+    int len = 0;
+    unsigned int tail = log_ring.tail;
+    unsigned int head = atomic_load_int(&log_ring.head);
+    while (tail != head) {
+        const char *s = log_ring.recs[tail & (LOG_NUM_RECS - 1)].buf;
+        int n = strlen(s);
+        if (len + n >= LOG_BATCH_SIZE) {
+            XPLMDebugString(batch);
+            len = 0;
+        }
+        memcpy(batch + len, s, n + 1);
+        len += n;
+        atomic_store_int(&log_ring.tail, ++tail);
+    }
+    if (len)
+        XPLMDebugString(batch);
+    unsigned int dropped = atomic_load_int(&log_ring.dropped);
+    if (dropped != log_ring.reported) {
+        snprintf(batch, sizeof(batch), "[%s]: dropped %u log records\r\n",
+            get_name(), dropped - log_ring.reported);
+        XPLMDebugString(batch);
+        log_ring.reported = dropped;
+    }
+}
+
+static float log_loop_cb(float last_call, float last_loop, int count,
+    void *ref) {
+    if (log_ring.tail != atomic_load_int(&log_ring.head) ||
+        log_ring.reported != log_ring.dropped) {
+        log_async_drain();
+    }
+    return -1.0f;
+}
+
+/**
+ * Switches _log and _debug over to asynchronous mode, in which records are
+ * queued and written to Log.txt once per frame. Both functions must then
+ * only be called from the sim thread.
+ */
+int log_async_init() {
+    if (log_ring.enabled)
+        return 1;
+    XPLMCreateFlightLoop_t params = {
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .refcon = NULL,
+        .callbackFunc = log_loop_cb
+    };
+    if (!(log_ring.loop_id = XPLMCreateFlightLoop(&params))) {
+        _log("log_async_init: could not create flight loop");
+        return 0;
+    }
+    XPLMScheduleFlightLoop(log_ring.loop_id, -1.0f, 0);
+    log_ring.enabled = 1;
+    return 1;
+}
+
+void log_async_deinit() {
+    if (!log_ring.enabled)
+        return;
+    XPLMDestroyFlightLoop(log_ring.loop_id);
+    log_ring.loop_id = NULL;
+    /* Flush whatever is still queued up. */
+    log_async_drain();
+    log_ring.enabled = 0;
+}
+
+unsigned int log_async_dropped() {
+    return atomic_load_int(&log_ring.dropped);
+}
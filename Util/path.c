@@ -9,47 +9,163 @@
  */
 #include "util.h"
 
-int get_plugin_dir(char *buf, int size) {
+#define INI_FILE_NAME "settings.ini"
+#define DATA_DIR_NAME "data/"
+
+/**
+ * Paths are resolved once, usually from XPluginStart, and then handed out
+ * as length-tracked strings so callers never have to query X-Plane or walk
+ * the strings again. The aircraft directory is resolved lazily and dropped
+ * whenever the user's aircraft changes.
+ */
+static struct {
+    path_t plugin_dir;
+    path_t plugin_name;
+    path_t data_dir;
+    path_t ini_file;
+    path_t acft_dir;
+    path_t acft_file;
+    int resolved;
+    int acft_resolved;
+} ctx;
+
+static int path_set(path_t *p, const char *s, int len) {
+    if (len < 0 || len >= PATH_BUF) {
+        p->str[0] = '\0';
+        p->len = 0;
+        return 0;
+    }
+    memcpy(p->str, s, len);
+    p->str[len] = '\0';
+    p->len = len;
+    return 1;
+}
+
+/* Returns the index of the last path separator before end, or -1. */
+static int path_last_sep(const char *s, int end) {
+    while (--end >= 0) {
+        if (s[end] == '/' || s[end] == '\\')
+            return end;
+    }
+    return -1;
+}
+
+int path_join(char *buf, int size, const path_t *dir, const char *file) {
+    int n = strlen(file);
+    if (!dir->len || dir->len + n >= size) {
+        if (size > 0)
+            buf[0] = '\0';
+        return 0;
+    }
+    memcpy(buf, dir->str, dir->len);
+    memcpy(buf + dir->len, file, n + 1);
+    return dir->len + n;
+}
+
+int path_init() {
+    char buf[PATH_BUF];
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.resolved = 1;
     XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
     XPLMGetPluginInfo(XPLMGetMyID(), NULL, buf, NULL, NULL);
     /* skip plugin filename */
-    char *p = strrchr(buf, '/');
-    if (!p)
+    int p = path_last_sep(buf, strlen(buf));
+    if (p < 0)
         return 0;
-    *p = 0;
     /* skip /64 directory */
-    p = strrchr(buf, '/');
-    if (!p)
+    int d = path_last_sep(buf, p);
+    if (d < 0)
         return 0;
-    *(p + 1) = 0;
+    path_set(&ctx.plugin_dir, buf, d + 1);
+    /* Plugin name is the name of the plugin's directory. */
+    int n = path_last_sep(buf, d);
+    path_set(&ctx.plugin_name, buf + n + 1, d - n - 1);
+    ctx.data_dir.len = path_join(ctx.data_dir.str, PATH_BUF, &ctx.plugin_dir,
+        DATA_DIR_NAME);
+    ctx.ini_file.len = path_join(ctx.ini_file.str, PATH_BUF, &ctx.plugin_dir,
+        INI_FILE_NAME);
     return 1;
 }
 
-int get_plugin_name(char *buf, int size) {
-    /* Unfortunately this returns a garbage name in the form of
-       plugin/64/win.xpl */
-    XPLMGetPluginInfo(XPLMGetMyID(), buf, NULL, NULL, NULL);
-    /* skip plugin filename */
-    char *p = strrchr(buf, '/');
-    if (!p)
-        return 0;
-    *p = 0;
-    /* skip /64 directory */
-    p = strrchr(buf, '/');
-    if (!p)
+const path_t *path_plugin_dir() {
+    if (!ctx.resolved)
+        path_init();
+    return &ctx.plugin_dir;
+}
+
+const path_t *path_plugin_name() {
+    if (!ctx.resolved)
+        path_init();
+    return &ctx.plugin_name;
+}
+
+const path_t *path_data_dir() {
+    if (!ctx.resolved)
+        path_init();
+    return &ctx.data_dir;
+}
+
+const path_t *path_ini_file() {
+    if (!ctx.resolved)
+        path_init();
+    return &ctx.ini_file;
+}
+
+static void path_resolve_acft() {
+    char name[MAX_NAME], buf[PATH_BUF];
+    ctx.acft_resolved = 1;
+    if (!ctx.resolved)
+        path_init();
+    XPLMGetNthAircraftModel(XPLM_USER_AIRCRAFT, name, buf);
+    int len = strlen(buf);
+    int p = path_last_sep(buf, len);
+    if (p < 0)
+        return;
+    path_set(&ctx.acft_file, buf, len);
+    path_set(&ctx.acft_dir, buf, p + 1);
+}
+
+const path_t *path_acft_dir() {
+    if (!ctx.acft_resolved)
+        path_resolve_acft();
+    return &ctx.acft_dir;
+}
+
+const path_t *path_acft_file() {
+    if (!ctx.acft_resolved)
+        path_resolve_acft();
+    return &ctx.acft_file;
+}
+
+/**
+ * Must be called when XPLM_MSG_PLANE_LOADED is received for the user's
+ * aircraft so the aircraft paths are resolved again on next use.
+ */
+void path_acft_changed() {
+    ctx.acft_resolved = 0;
+    ctx.acft_dir.len = ctx.acft_file.len = 0;
+    ctx.acft_dir.str[0] = ctx.acft_file.str[0] = '\0';
+}
+
+static int path_copy(const path_t *p, char *buf, int size) {
+    if (!p->len || p->len >= size)
         return 0;
-    *p = 0;
+    memcpy(buf, p->str, p->len + 1);
     return 1;
 }
 
-int get_acft_dir(char *buf, int size) {
+int get_plugin_dir(char *buf, int size) {
+    return path_copy(path_plugin_dir(), buf, size);
+}
 
+int get_plugin_name(char *buf, int size) {
+    return path_copy(path_plugin_name(), buf, size);
+}
+
+int get_acft_dir(char *buf, int size) {
+    return path_copy(path_acft_dir(), buf, size);
 }
 
 int get_data_path(const char *file, char *buf, int size) {
-    if (!get_plugin_dir(buf, size))
-        return 0;
-    strncat(buf, "data/", size);
-    strncat(buf, file, size);
-    return 1;
-}
\ No newline at end of file
+    return path_join(buf, size, path_data_dir(), file) > 0;
+}
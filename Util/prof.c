@@ -0,0 +1,225 @@
+/**
+ * Utility library for X-Plane 11 Plugins.
+ *
+ * Static library containing common functionality for stuff like logging and
+ * dealing with configuration files. Linked against by most plugins in the
+ * solution.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "util.h"
+#include "../XP/XPLMDisplay.h"
+#include "../XP/XPLMGraphics.h"
+#include <stdlib.h>
+
+#define PROF_REFRESH_NS     500000000LL
+#define PROF_LINE_SIZE      96
+#define PROF_CSV_NAME       "profile.csv"
+
+/**
+ * Measures the sim-thread time spent in a plugin's callbacks. Each callback
+ * gets a slot holding its most recent PROF_WINDOW durations in a ring, from
+ * which percentiles are computed on demand, plus running totals. Slots are
+ * fixed-size and only ever written by the sim thread, so recording a sample
+ * is a couple of stores without any allocation or locking.
+ *
+ * Timers are placed with prof_begin and prof_end, which only test
+ * prof_enabled while profiling is off. Results can be shown in an overlay
+ * and dumped to a CSV file through commands.
+ */
+typedef struct {
+    char name[32];
+    unsigned int samples[PROF_WINDOW];
+    unsigned int count;
+    long long total;
+    unsigned int max;
+} prof_slot_t;
+
+typedef struct {
+    unsigned int p50;
+    unsigned int p99;
+    unsigned int max;
+} prof_pct_t;
+
+int prof_enabled;
+
+static struct {
+    prof_slot_t slots[PROF_MAX_SLOTS];
+    int num_slots;
+    int overlay;
+    XPLMCommandRef overlay_cmd;
+    XPLMCommandRef dump_cmd;
+    /* overlay text, refreshed every PROF_REFRESH_NS */
+    char lines[PROF_MAX_SLOTS + 1][PROF_LINE_SIZE];
+    long long refreshed;
+} prof;
+
+/**
+ * Returns the id of the slot with the specified name, adding it if it
+ * doesn't exist yet. Returns -1 if all slots are taken, in which case timers
+ * using the id record nothing.
+ */
+int prof_register(const char *name) {
+    for (int i = 0; i < prof.num_slots; i++) {
+        if (!strcmp(prof.slots[i].name, name))
+            return i;
+    }
+    if (prof.num_slots >= PROF_MAX_SLOTS) {
+        _log("prof_register: too many slots, can't add %s", name);
+        return -1;
+    }
+    prof_slot_t *s = &prof.slots[prof.num_slots];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    return prof.num_slots++;
+}
+
+void prof_add(int id, long long start) {
+    if (id < 0)
+        return;
+    long long ns = get_time_ns() - start;
+    unsigned int v = ns > 0xFFFFFFFFLL ? 0xFFFFFFFFu : (unsigned int)ns;
+    prof_slot_t *s = &prof.slots[id];
+    s->samples[s->count++ & (PROF_WINDOW - 1)] = v;
+    s->total += ns;
+    if (v > s->max)
+        s->max = v;
+}
+
+static int prof_cmp(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Percentiles over the samples currently in the slot's window. */
+static void prof_percentiles(const prof_slot_t *s, prof_pct_t *p) {
+    unsigned int buf[PROF_WINDOW];
+    unsigned int n = min(s->count, PROF_WINDOW);
+    memset(p, 0, sizeof(*p));
+    if (!n)
+        return;
+    memcpy(buf, s->samples, n * sizeof(buf[0]));
+    qsort(buf, n, sizeof(buf[0]), prof_cmp);
+    p->p50 = buf[n / 2];
+    p->p99 = buf[min(n * 99 / 100, n - 1)];
+    p->max = buf[n - 1];
+}
+
+static void prof_refresh() {
+    snprintf(prof.lines[0], PROF_LINE_SIZE, "%-20s %8s %8s %8s %8s",
+        "callback (us)", "calls", "p50", "p99", "max");
+    for (int i = 0; i < prof.num_slots; i++) {
+        prof_slot_t *s = &prof.slots[i];
+        prof_pct_t p;
+        prof_percentiles(s, &p);
+        snprintf(prof.lines[i + 1], PROF_LINE_SIZE,
+            "%-20.20s %8u %8.1f %8.1f %8.1f", s->name, s->count,
+            p.p50 / 1000.0f, p.p99 / 1000.0f, p.max / 1000.0f);
+    }
+}
+
+static int prof_draw_cb(XPLMDrawingPhase phase, int before, void *ref) {
+    static float white[] = { 1.0f, 1.0f, 1.0f };
+    int width, height;
+    long long now = get_frame_time_ns();
+    if (now - prof.refreshed >= PROF_REFRESH_NS) {
+        prof_refresh();
+        prof.refreshed = now;
+    }
+    XPLMGetScreenSize(&width, &height);
+    for (int i = 0; i <= prof.num_slots; i++) {
+        XPLMDrawString(white, width - 420, height - 60 - 12 * i,
+            prof.lines[i], NULL, xplmFont_Basic);
+    }
+    return 1;
+}
+
+/**
+ * Writes the statistics of all slots to the specified file. Times are in
+ * microseconds, percentiles and max refer to the most recent PROF_WINDOW
+ * calls while calls and total cover everything since profiling started.
+ */
+int prof_dump(const char *file) {
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        _log("prof_dump: could not open '%s'", file);
+        return 0;
+    }
+    fprintf(fp, "callback,calls,total_us,mean_us,p50_us,p99_us,max_us,"
+        "max_ever_us\n");
+    for (int i = 0; i < prof.num_slots; i++) {
+        prof_slot_t *s = &prof.slots[i];
+        prof_pct_t p;
+        prof_percentiles(s, &p);
+        fprintf(fp, "%s,%u,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f\n", s->name,
+            s->count, s->total / 1000.0, s->count ? s->total / 1000.0 /
+            s->count : 0, p.p50 / 1000.0, p.p99 / 1000.0, p.max / 1000.0,
+            s->max / 1000.0);
+    }
+    fclose(fp);
+    return 1;
+}
+
+static void prof_set_overlay(int on) {
+    if (on == prof.overlay)
+        return;
+    if (on) {
+        prof.refreshed = 0;
+        XPLMRegisterDrawCallback(prof_draw_cb, xplm_Phase_Window, 0, NULL);
+    } else {
+        XPLMUnregisterDrawCallback(prof_draw_cb, xplm_Phase_Window, 0, NULL);
+    }
+    prof.overlay = on;
+}
+
+static int prof_overlay_cb(XPLMCommandRef cmd, XPLMCommandPhase phase,
+    void *ref) {
+    if (phase != xplm_CommandBegin)
+        return 1;
+    /* There's nothing to show unless profiling, so turn it on as well. */
+    prof_enabled = 1;
+    prof_set_overlay(!prof.overlay);
+    return 1;
+}
+
+static int prof_dump_cb(XPLMCommandRef cmd, XPLMCommandPhase phase,
+    void *ref) {
+    char path[PATH_BUF];
+    if (phase != xplm_CommandBegin)
+        return 1;
+    if (path_join(path, sizeof(path), path_plugin_dir(), PROF_CSV_NAME) &&
+        prof_dump(path)) {
+        _log("wrote profile of %i callbacks to '%s'", prof.num_slots, path);
+    }
+    return 1;
+}
+
+/**
+ * Creates the <plugin>/profiler/toggle_overlay and <plugin>/profiler/dump_csv
+ * commands. Profiling itself starts out enabled if the profile setting is
+ * set, or once the overlay is first shown.
+ */
+int prof_init() {
+    char name[PATH_BUF + 32];
+    const char *plugin = path_plugin_name()->str;
+    if (prof.overlay_cmd)
+        return 1;
+    prof_enabled = ini_geti("profile", 0);
+    snprintf(name, sizeof(name), "%s/profiler/toggle_overlay", plugin);
+    prof.overlay_cmd = cmd_create(name, "Toggle callback profiler overlay",
+        prof_overlay_cb, NULL);
+    snprintf(name, sizeof(name), "%s/profiler/dump_csv", plugin);
+    prof.dump_cmd = cmd_create(name, "Write callback profile to CSV file",
+        prof_dump_cb, NULL);
+    return prof.overlay_cmd && prof.dump_cmd;
+}
+
+void prof_deinit() {
+    prof_set_overlay(0);
+    if (prof.overlay_cmd)
+        cmd_free(prof.overlay_cmd, prof_overlay_cb, NULL);
+    if (prof.dump_cmd)
+        cmd_free(prof.dump_cmd, prof_dump_cb, NULL);
+    prof.overlay_cmd = prof.dump_cmd = NULL;
+    prof_enabled = 0;
+}
@@ -7,50 +7,247 @@
  *
  * Copyright 2019 Torben Knke.
  */
+#ifdef LIN
+#define _GNU_SOURCE /* dladdr */
+#endif
 #include "util.h"
+#include "../XP/XPLMProcessing.h"
+#ifndef IBM
+#include <dlfcn.h>
+#endif
 
 static FMOD_SYSTEM *fmod_sys;
 
+/**
+ * All plugins linking Util share one FMOD system, and with it one mixer
+ * thread and one voice budget. The system is published through a shared
+ * byte-array dataref that X-Plane owns, so it outlives whichever plugin
+ * created it. Every plugin attaching increments the reference count and the
+ * last one to detach closes the system. Since plugins may ship their own
+ * copy of the FMOD library, a system is only reused if it was created by
+ * the same loaded instance of the library, identified by its module handle
+ * or base address, and the same version of it.
+ */
+#define SND_SHARED_DATAREF  "S22/Util/snd_system"
+#define SND_SHARED_VERSION  2
+#define SND_MAX_CHANNELS    32
+#define SND_FMOD_DLL        "fmod64.dll"
+
+typedef struct {
+    unsigned int version;
+    int refs;
+    FMOD_SYSTEM *sys;
+    void *lib;
+    unsigned int fmod_version;
+} snd_shared_t;
+
+static XPLMDataRef shared_dr;
+static int shared_attached;
+
+/**
+ * Each volume category has its own channel group that sounds are played
+ * into. The group volumes track X-Plane's volume sliders from a single
+ * flight loop, so playing a sound doesn't need to read any datarefs and a
+ * change to a slider also affects sounds that are already playing.
+ */
 typedef struct {
     char *name;
     XPLMDataRef dr;
+    FMOD_CHANNELGROUP *group;
+    float ratio;
 } vol_tbl_t;
 
 static vol_tbl_t vol_tbl[] = {
-    { "sim/operation/sound/master_volume_ratio",    NULL },
-    { "sim/operation/sound/exterior_volume_ratio",  NULL },
-    { "sim/operation/sound/interior_volume_ratio",  NULL },
-    { "sim/operation/sound/copilot_volume_ratio",   NULL },
-    { "sim/operation/sound/radio_volume_ratio",     NULL },
-    { "sim/operation/sound/enviro_volume_ratio",    NULL },
-    { "sim/operation/sound/ui_volume_ratio",        NULL }
+    { "sim/operation/sound/master_volume_ratio",    NULL, NULL, -1 },
+    { "sim/operation/sound/exterior_volume_ratio",  NULL, NULL, -1 },
+    { "sim/operation/sound/interior_volume_ratio",  NULL, NULL, -1 },
+    { "sim/operation/sound/copilot_volume_ratio",   NULL, NULL, -1 },
+    { "sim/operation/sound/radio_volume_ratio",     NULL, NULL, -1 },
+    { "sim/operation/sound/enviro_volume_ratio",    NULL, NULL, -1 },
+    { "sim/operation/sound/ui_volume_ratio",        NULL, NULL, -1 }
 };
 static const int num_vol_tbl = sizeof(vol_tbl) / sizeof(vol_tbl[0]);
+static XPLMFlightLoopID vol_loop_id;
 
-int snd_init() {
-    FMOD_RESULT err = FMOD_System_Create(&fmod_sys);
-    if (err) {
-        _log("snd_init: could not create fmod system (%i)", err);
+#define SND_VOL_INTERVAL 0.25f /* seconds */
+
+/**
+ * Samples in the bank are decoded to PCM when they are loaded, so playing
+ * them back later neither allocates nor decodes anything.
+ */
+#define SND_BANK_SIZE 32
+
+typedef struct {
+    FMOD_SOUND *sound;
+    unsigned int bytes;
+    long long load_us;
+} snd_sample_t;
+
+static snd_sample_t bank[SND_BANK_SIZE];
+static int bank_size;
+static unsigned int bank_bytes;
+
+/**
+ * Returns the module the FMOD functions we call actually live in. Taking the
+ * address of FMOD_System_Create doesn't do on Windows, as fmod.h doesn't
+ * declare the functions dllimport and every plugin would get the address of
+ * its own import thunk.
+ */
+static void *snd_lib_id() {
+#ifdef IBM
+    return GetModuleHandleA(SND_FMOD_DLL);
+#else
+    Dl_info info;
+    if (!dladdr((void*)FMOD_System_Create, &info))
+        return NULL;
+    return info.dli_fbase;
+#endif
+}
+
+static int snd_shared_get(snd_shared_t *sh) {
+    memset(sh, 0, sizeof(snd_shared_t));
+    if (!shared_dr)
+        return 0;
+    if (XPLMGetDatab(shared_dr, sh, 0, sizeof(snd_shared_t)) !=
+        sizeof(snd_shared_t)) {
         return 0;
     }
-    err = FMOD_System_Init(fmod_sys, 32, FMOD_INIT_NORMAL, 0);
+    return sh->version == SND_SHARED_VERSION && sh->refs > 0 && sh->sys &&
+        sh->lib && sh->lib == snd_lib_id() &&
+        sh->fmod_version == FMOD_VERSION;
+}
+
+static void snd_shared_set(const snd_shared_t *sh) {
+    XPLMSetDatab(shared_dr, (void*)sh, 0, sizeof(snd_shared_t));
+}
+
+static FMOD_RESULT snd_create_system(FMOD_SYSTEM **sys) {
+    FMOD_RESULT err = FMOD_System_Create(sys);
+    if (err)
+        return err;
+#ifdef LIN
+    /* Mix but discard the output, for running headless. */
+    if (ini_geti("snd_null_output", 0))
+        FMOD_System_SetOutput(*sys, FMOD_OUTPUTTYPE_NOSOUND);
+#endif
+    err = FMOD_System_Init(*sys, SND_MAX_CHANNELS, FMOD_INIT_NORMAL, 0);
+#ifdef LIN
     if (err) {
-        _log("snd_init: could not init fmod system (%i)", err);
-        return 0;
+        _log("snd_init: no audio output (%i), falling back to null output",
+            err);
+        FMOD_System_SetOutput(*sys, FMOD_OUTPUTTYPE_NOSOUND);
+        err = FMOD_System_Init(*sys, SND_MAX_CHANNELS, FMOD_INIT_NORMAL, 0);
+    }
+#endif
+    if (err) {
+        FMOD_System_Release(*sys);
+        *sys = NULL;
     }
-    /* init the volume datarefs */
+    return err;
+}
+
+static float snd_vol_loop_cb(float last_call, float last_loop, int count,
+    void *ref) {
+    for (int i = 0; i < num_vol_tbl; i++) {
+        float ratio = XPLMGetDataf(vol_tbl[i].dr);
+        if (ratio != vol_tbl[i].ratio) {
+            vol_tbl[i].ratio = ratio;
+            FMOD_ChannelGroup_SetVolume(vol_tbl[i].group, ratio);
+        }
+    }
+    return SND_VOL_INTERVAL;
+}
+
+int snd_init() {
+    if (fmod_sys)
+        return 1;
+    snd_shared_t sh;
+    if (XPLMShareData(SND_SHARED_DATAREF, xplmType_Data, NULL, NULL))
+        shared_dr = XPLMFindDataRef(SND_SHARED_DATAREF);
+    if (snd_shared_get(&sh)) {
+        fmod_sys = sh.sys;
+        sh.refs++;
+        snd_shared_set(&sh);
+        shared_attached = 1;
+        _log("snd_init: attached to shared fmod system (%i users)", sh.refs);
+    } else {
+        FMOD_RESULT err = snd_create_system(&fmod_sys);
+        if (err) {
+            _log("snd_init: could not init fmod system (%i)", err);
+            return 0;
+        }
+        /* Publish it, unless another library instance already did. */
+        if (shared_dr && !sh.refs) {
+            sh.version = SND_SHARED_VERSION;
+            sh.refs = 1;
+            sh.sys = fmod_sys;
+            sh.lib = snd_lib_id();
+            sh.fmod_version = FMOD_VERSION;
+            snd_shared_set(&sh);
+            shared_attached = 1;
+        }
+    }
+    /* init the volume datarefs and channel groups */
     for (int i = 0; i < num_vol_tbl; i++) {
         vol_tbl[i].dr = XPLMFindDataRef(vol_tbl[i].name);
         if (!vol_tbl[i].dr) {
             _log("snd_init: could not find dataref (%s)", vol_tbl[i].name);
-            return 0;
+            goto fail;
         }
+        FMOD_RESULT err = FMOD_System_CreateChannelGroup(fmod_sys,
+            vol_tbl[i].name, &vol_tbl[i].group);
+        if (err) {
+            _log("snd_init: could not create channel group (%i)", err);
+            goto fail;
+        }
+        vol_tbl[i].ratio = -1;
+    }
+    snd_vol_loop_cb(0, 0, 0, NULL);
+    XPLMCreateFlightLoop_t params = {
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_AfterFlightModel,
+        .refcon = NULL,
+        .callbackFunc = snd_vol_loop_cb
+    };
+    if (!(vol_loop_id = XPLMCreateFlightLoop(&params))) {
+        _log("snd_init: could not create flight loop");
+        goto fail;
     }
+    XPLMScheduleFlightLoop(vol_loop_id, SND_VOL_INTERVAL, 0);
     _log("snd_init: initialized");
     return 1;
+fail:
+    /* Release the groups created so far and detach again, or close the
+       system if nobody else is using it. */
+    snd_deinit();
+    return 0;
 }
 
 int snd_deinit() {
+    snd_bank_free();
+    if (vol_loop_id)
+        XPLMDestroyFlightLoop(vol_loop_id);
+    vol_loop_id = NULL;
+    for (int i = 0; i < num_vol_tbl; i++) {
+        if (vol_tbl[i].group)
+            FMOD_ChannelGroup_Release(vol_tbl[i].group);
+        vol_tbl[i].group = NULL;
+    }
+    if (fmod_sys && shared_attached) {
+        snd_shared_t sh;
+        shared_attached = 0;
+        if (snd_shared_get(&sh) && sh.sys == fmod_sys) {
+            if (--sh.refs > 0) {
+                snd_shared_set(&sh);
+                fmod_sys = NULL;
+                _log("snd_deinit: detached from shared fmod system");
+                return 1;
+            }
+            /* We're the last user, so close the system down. */
+            memset(&sh, 0, sizeof(sh));
+            snd_shared_set(&sh);
+        }
+    }
     if (fmod_sys) {
         FMOD_RESULT err = FMOD_System_Close(fmod_sys);
         if (err) {
@@ -72,8 +269,8 @@ snd_t snd_create(const char *file) {
         return NULL;
     }
     FMOD_SOUND *s;
-    FMOD_RESULT err = FMOD_System_CreateSound(fmod_sys, file, FMOD_DEFAULT,
-        0, &s);
+    FMOD_RESULT err = FMOD_System_CreateSound(fmod_sys, file,
+        FMOD_DEFAULT | FMOD_CREATESAMPLE, 0, &s);
     if (err) {
         _log("snd_create: could not create sound '%s' (%i)", file, err);
         return NULL;
@@ -96,6 +293,18 @@ int snd_free(snd_t s) {
     return 1;
 }
 
+static int snd_play_sound(FMOD_SOUND *s, snd_vol_t vol) {
+    FMOD_CHANNEL *channel;
+    /* The category's channel group takes care of the volume. */
+    FMOD_RESULT err = FMOD_System_PlaySound(fmod_sys, s, vol_tbl[vol].group,
+        0, &channel);
+    if (err) {
+        _log("snd_play: could not play sound (%i)", err);
+        return 0;
+    }
+    return 1;
+}
+
 int snd_play(snd_t s, snd_vol_t vol) {
     if (!fmod_sys) {
         _log("snd_play: sound system not initialized");
@@ -105,16 +314,75 @@ int snd_play(snd_t s, snd_vol_t vol) {
         _log("snd_play: sound handle is NULL");
         return 0;
     }
-    FMOD_CHANNEL *channel;
-    FMOD_RESULT err = FMOD_System_PlaySound(fmod_sys, (FMOD_SOUND*)s, 0, 0,
-        &channel);
-    if (err) {
-        _log("snd_play: could not play sound (%i)", err);
+    return snd_play_sound((FMOD_SOUND*)s, vol);
+}
+
+/**
+ * Loads the specified files from the plugin's data directory into the
+ * sample bank. The handle for each file is stored in ids, or -1 if the file
+ * could not be loaded. Returns the number of samples loaded.
+ */
+int snd_bank_load(const char **files, int *ids, int num) {
+    char path[PATH_BUF];
+    int loaded = 0;
+    /* Callers check for -1, so mark everything unavailable up-front. */
+    for (int i = 0; i < num; i++)
+        ids[i] = -1;
+    if (!fmod_sys) {
+        _log("snd_bank_load: sound system not initialized");
         return 0;
     }
-    float ratio = XPLMGetDataf(vol_tbl[vol].dr);
-    err = FMOD_Channel_SetVolume(channel, ratio);
-    if (err)
-        _log("snd_play: could not set channel volume (%i)", err);
-    return 1;
+    long long start = get_time_ns();
+    for (int i = 0; i < num; i++) {
+        if (bank_size >= SND_BANK_SIZE) {
+            _log("snd_bank_load: bank is full, skipping '%s'", files[i]);
+            continue;
+        }
+        if (!path_join(path, sizeof(path), path_data_dir(), files[i])) {
+            _log("snd_bank_load: invalid path for '%s'", files[i]);
+            continue;
+        }
+        snd_sample_t *smp = &bank[bank_size];
+        long long t = get_time_ns();
+        FMOD_RESULT err = FMOD_System_CreateSound(fmod_sys, path,
+            FMOD_DEFAULT | FMOD_CREATESAMPLE, 0, &smp->sound);
+        if (err) {
+            _log("snd_bank_load: could not load '%s' (%i)", path, err);
+            smp->sound = NULL;
+            continue;
+        }
+        smp->load_us = (get_time_ns() - t) / 1000;
+        if (FMOD_Sound_GetLength(smp->sound, &smp->bytes,
+            FMOD_TIMEUNIT_PCMBYTES)) {
+            smp->bytes = 0;
+        }
+        bank_bytes += smp->bytes;
+        _log("snd_bank_load: loaded '%s' (%u bytes, %lli us)", files[i],
+            smp->bytes, smp->load_us);
+        ids[i] = bank_size++;
+        loaded++;
+    }
+    _log("snd_bank_load: loaded %i of %i samples in %lli us, bank now uses "
+        "%u bytes", loaded, num, (get_time_ns() - start) / 1000, bank_bytes);
+    return loaded;
+}
+
+int snd_bank_play(int id, snd_vol_t vol) {
+    if (id < 0 || id >= bank_size || !bank[id].sound)
+        return 0;
+    return snd_play_sound(bank[id].sound, vol);
+}
+
+unsigned int snd_bank_mem() {
+    return bank_bytes;
+}
+
+void snd_bank_free() {
+    for (int i = 0; i < bank_size; i++) {
+        if (bank[i].sound)
+            FMOD_Sound_Release(bank[i].sound);
+    }
+    memset(bank, 0, sizeof(bank));
+    bank_size = 0;
+    bank_bytes = 0;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+/**
+ * Utility library for X-Plane 11 Plugins.
+ *
+ * Static library containing common functionality for stuff like logging and
+ * dealing with configuration files. Linked against by most plugins in the
+ * solution.
+ *
+ * Copyright 2019 Torben Knke.
+ */
+#include "util.h"
+#include <stdlib.h>
+#ifndef IBM
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * Thin wrapper around Win32 and POSIX threads. Note that the XPLM API must
+ * only ever be called from the sim thread, so neither must threads started
+ * through here call _log or _debug.
+ */
+typedef struct {
+    thread_func_t func;
+    void *arg;
+#ifdef IBM
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} thread_ctx_t;
+
+#ifdef IBM
+static DWORD WINAPI thread_main(LPVOID param) {
+#else
+static void *thread_main(void *param) {
+#endif
+    thread_ctx_t *ctx = (thread_ctx_t*)param;
+    ctx->func(ctx->arg);
+    return 0;
+}
+
+thread_t thread_create(thread_func_t func, void *arg) {
+    thread_ctx_t *ctx = malloc(sizeof(thread_ctx_t));
+    if (!ctx)
+        return NULL;
+    ctx->func = func;
+    ctx->arg = arg;
+#ifdef IBM
+    ctx->handle = CreateThread(NULL, 0, thread_main, ctx, 0, NULL);
+    if (!ctx->handle) {
+        _log("thread_create: could not create thread (%i)", GetLastError());
+        free(ctx);
+        return NULL;
+    }
+#else
+    int err = pthread_create(&ctx->handle, NULL, thread_main, ctx);
+    if (err) {
+        _log("thread_create: could not create thread (%i)", err);
+        free(ctx);
+        return NULL;
+    }
+#endif
+    return ctx;
+}
+
+void thread_join(thread_t t) {
+    thread_ctx_t *ctx = (thread_ctx_t*)t;
+    if (!ctx)
+        return;
+#ifdef IBM
+    WaitForSingleObject(ctx->handle, INFINITE);
+    CloseHandle(ctx->handle);
+#else
+    pthread_join(ctx->handle, NULL);
+#endif
+    free(ctx);
+}
+
+/**
+ * Gives up the rest of the calling thread's time slice.
+ */
+void thread_yield() {
+#ifdef IBM
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
@@ -8,20 +8,90 @@
  * Copyright 2019 Torben Knke.
  */
 #include "util.h"
+#include "../XP/XPLMProcessing.h"
+#ifdef APL
+#include <mach/mach_time.h>
+#elif !defined(IBM)
+#include <time.h>
+#endif
 
-long long get_time_ms() {
+/**
+ * Timestamp taken once at the start of each frame so that all callbacks
+ * running during the same frame share a single clock read. 0 while the
+ * frame loop isn't running.
+ */
+static long long frame_ns;
+static XPLMFlightLoopID frame_loop_id;
+
+/**
+ * Returns a monotonic timestamp in nanoseconds. The value has no relation to
+ * wall-clock time and is only meaningful for measuring intervals.
+ */
+long long get_time_ns() {
 #ifdef IBM
-    static const __int64 EPOCH = ((__int64)116444736000000000ULL);
-    SYSTEMTIME st;
-    FILETIME ft;
-    GetSystemTime(&st);
-    SystemTimeToFileTime(&st, &ft);
-    __int64 time = (((__int64)ft.dwHighDateTime) << 32) +
-        ft.dwLowDateTime;
-    return 1000L * ((time - EPOCH) / 10000000L) + st.wMilliseconds;
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    /* Split up to avoid overflowing for large counter values. */
+    return (now.QuadPart / freq.QuadPart) * 1000000000LL +
+        (now.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart;
+#elif APL
+    static mach_timebase_info_data_t tb;
+    if (!tb.denom)
+        mach_timebase_info(&tb);
+    return (long long)(mach_absolute_time() * tb.numer / tb.denom);
 #else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (((long long)tv.tv_sec) * 1000) + (tv.tv_usec / 1000);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 #endif
 }
+
+long long get_time_ms() {
+    return get_time_ns() / 1000000;
+}
+
+long long get_frame_time_ns() {
+    return frame_ns ? frame_ns : get_time_ns();
+}
+
+long long get_frame_time_ms() {
+    return get_frame_time_ns() / 1000000;
+}
+
+static float time_loop_cb(float last_call, float last_loop, int count,
+    void *ref) {
+    frame_ns = get_time_ns();
+    return -1.0f;
+}
+
+/**
+ * Starts stamping frames. Until this is called or after time_deinit, the
+ * get_frame_time functions read the clock on every call.
+ */
+int time_init() {
+    if (frame_loop_id)
+        return 1;
+    XPLMCreateFlightLoop_t params = {
+        .structSize = sizeof(XPLMCreateFlightLoop_t),
+        .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+        .refcon = NULL,
+        .callbackFunc = time_loop_cb
+    };
+    if (!(frame_loop_id = XPLMCreateFlightLoop(&params))) {
+        _log("time_init: could not create flight loop");
+        return 0;
+    }
+    XPLMScheduleFlightLoop(frame_loop_id, -1.0f, 0);
+    frame_ns = get_time_ns();
+    return 1;
+}
+
+void time_deinit() {
+    if (frame_loop_id)
+        XPLMDestroyFlightLoop(frame_loop_id);
+    frame_loop_id = NULL;
+    frame_ns = 0;
+}
@@ -46,9 +46,31 @@
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 #endif /* min */
 
+/* Minimal set of atomics usable from both MSVC's C compiler, which lacks
+   stdatomic.h, and clang. */
+#ifdef _WIN32
+#include <intrin.h>
+#define atomic_load_int(p)      _InterlockedOr((volatile long*)(p), 0)
+#define atomic_store_int(p, v)  _InterlockedExchange((volatile long*)(p), (v))
+#define atomic_add_int(p, v)    _InterlockedExchangeAdd((volatile long*)(p), (v))
+#define atomic_load_ptr(p)      _InterlockedCompareExchangePointer( \
+                                    (void* volatile*)(p), NULL, NULL)
+#define atomic_store_ptr(p, v)  _InterlockedExchangePointer( \
+                                    (void* volatile*)(p), (v))
+#else
+#define atomic_load_int(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_int(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_add_int(p, v)    __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_load_ptr(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_ptr(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif /* _WIN32 */
+
 #ifndef MAX_PATH
 #define MAX_PATH 512
 #endif
+/* Size of buffers the SDK fills with paths and of anything built from them.
+   The SDK wants 512 bytes while windows.h defines MAX_PATH as 260. */
+#define PATH_BUF 512
 #ifndef MAX_NAME
 #define MAX_NAME 256
 #endif
@@ -60,12 +82,65 @@ int ini_setf(const char *name, float val);
 float ini_getf(const char *name, float def);
 void ini_gets(const char *name, char *buf, int size, const char *def);
 int ini_sets(const char *name, const char *val);
+int ini_reload();
 
 /* log */
+#define LOG_LVL_TRACE   0
+#define LOG_LVL_DEBUG   1
+#define LOG_LVL_INFO    2
+#define LOG_LVL_WARN    3
+#define LOG_LVL_ERROR   4
+#define LOG_LVL_NONE    5
+
+/* Calls below this level are compiled out entirely, so release builds
+   drop trace and debug calls. */
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL   LOG_LVL_INFO
+#else
+#define LOG_MIN_LEVEL   LOG_LVL_TRACE
+#endif /* NDEBUG */
+#endif /* LOG_MIN_LEVEL */
+
+/* Runtime level, checked before any of the arguments are evaluated. It is
+   -1 until initialized from settings.ini, so the first call always makes
+   it into log_printf which then takes care of that. */
+extern int log_level;
+
+#define LOG_AT(lvl, ...)                                        \
+    do {                                                        \
+        if ((lvl) >= LOG_MIN_LEVEL && (lvl) >= log_level)       \
+            log_printf((lvl), __VA_ARGS__);                     \
+    } while (0)
+#define log_trace(...)  LOG_AT(LOG_LVL_TRACE, __VA_ARGS__)
+#define log_debug(...)  LOG_AT(LOG_LVL_DEBUG, __VA_ARGS__)
+#define log_info(...)   LOG_AT(LOG_LVL_INFO, __VA_ARGS__)
+#define log_warn(...)   LOG_AT(LOG_LVL_WARN, __VA_ARGS__)
+#define log_error(...)  LOG_AT(LOG_LVL_ERROR, __VA_ARGS__)
+
 void _log(const char *fmt, ...);
 void _debug(const char *fmt, ...);
+void log_printf(int lvl, const char *fmt, ...);
+void log_set_level(int lvl);
+void log_deinit();
+int log_async_init();
+void log_async_deinit();
+unsigned int log_async_dropped();
 
 /* path */
+typedef struct {
+    char str[PATH_BUF];
+    int len;
+} path_t;
+int path_init();
+const path_t *path_plugin_dir();
+const path_t *path_plugin_name();
+const path_t *path_data_dir();
+const path_t *path_ini_file();
+const path_t *path_acft_dir();
+const path_t *path_acft_file();
+void path_acft_changed();
+int path_join(char *buf, int size, const path_t *dir, const char *file);
 int get_plugin_dir(char *buf, int size);
 int get_plugin_name(char *buf, int size);
 int get_acft_dir(char *buf, int size);
@@ -87,14 +162,65 @@ int snd_deinit();
 snd_t snd_create(const char *file);
 int snd_free(snd_t s);
 int snd_play(snd_t s, snd_vol_t vol);
+int snd_bank_load(const char **files, int *ids, int num);
+int snd_bank_play(int id, snd_vol_t vol);
+unsigned int snd_bank_mem();
+void snd_bank_free();
 
 /* cmd */
 XPLMCommandRef cmd_create(const char *name, const char *desc,
     XPLMCommandCallback_f cb, void *data);
 void cmd_free(XPLMCommandRef *cmd, XPLMCommandCallback_f cb, void *data);
 
+/* dr */
+int dr_stage(const char *name);
+float dr_getf(int id);
+void dr_setf(int id, float val);
+int dr_flush();
+void dr_invalidate();
+void dr_clear();
+
 /* time */
+long long get_time_ns();
 long long get_time_ms();
+long long get_frame_time_ns();
+long long get_frame_time_ms();
+int time_init();
+void time_deinit();
+
+/* prof */
+#define PROF_MAX_SLOTS  16
+#define PROF_WINDOW     256 /* must be a power of 2 */
+
+/* Checked inline so that while profiling is off, a timer costs no more than
+   a well-predicted branch. */
+extern int prof_enabled;
+
+#define prof_begin() (prof_enabled ? get_time_ns() : 0)
+#define prof_end(id, start)                                     \
+    do {                                                        \
+        if (start)                                              \
+            prof_add((id), (start));                            \
+    } while (0)
+
+int prof_register(const char *name);
+void prof_add(int id, long long start);
+int prof_dump(const char *file);
+int prof_init();
+void prof_deinit();
+
+/* thread */
+typedef void *thread_t;
+typedef void(*thread_func_t)(void *arg);
+thread_t thread_create(thread_func_t func, void *arg);
+void thread_join(thread_t t);
+void thread_yield();
+
+/* fmap */
+typedef void *fmap_t;
+fmap_t fmap_create(const char *path, unsigned int size);
+void *fmap_ptr(fmap_t m);
+void fmap_close(fmap_t m);
 
 /* menu */
 #define MAX_MENU_ITEMS 16